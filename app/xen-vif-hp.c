@@ -96,7 +96,7 @@ int main(int argc, char** argv)
 
 
     /* Execute */
-    xs = xs_open(0);
+    xs = xs_open_k();
     if (xs == NULL) {
         goto out;
     }
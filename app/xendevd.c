@@ -33,18 +33,39 @@
  *
  */
 
+#include <xdd/aimd.h>
+#include <xdd/blk.h>
 #include <xdd/bridge.h>
+#include <xdd/dev_table.h>
 #include <xdd/iface.h>
+#include <xdd/log.h>
+#include <xdd/notify.h>
+#include <xdd/ovs.h>
+#include <xdd/probe.h>
+#include <xdd/timer.h>
+#include <xdd/trace.h>
 #include <xdd/vbd.h>
 #include <xdd/vif.h>
+#include <xdd/vif_backend.h>
+#include <xdd/vif_route.h>
+#include <xdd/xs_async.h>
+#include <xdd/xs_cache.h>
 #include <xdd/xs_helper.h>
 
+#include <errno.h>
 #include <fcntl.h>
 #include <libudev.h>
 #include <getopt.h>
+#include <net/if.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <unistd.h>
 #include <xenstore.h>
 
@@ -54,19 +75,207 @@ enum operation {
     OFFLINE ,
 };
 
+/* Largest uevent accepted on the inject socket */
+#define UEVENT_BUFFER_SIZE  8192
+
+/* Status line refresh for the service manager without a watchdog */
+#define NOTIFY_STATUS_MS    1000
+
+/* Records replayed per main loop iteration */
+#define REPLAY_BATCH        64
+
+/* Checks of the main xenstore connection, see struct xdd_xs_check */
+#define XS_CHECK_MS     1000
+#define XS_OPEN_WAIT_MS 100
+
+/* Backoff for retrying transient failures, doubling from min to max */
+#define RETRY_MIN_MS    50
+#define RETRY_MAX_MS    2000
+
+/*
+ * A xen-backend uevent, detached from libudev so it can be handed to a
+ * worker thread.
+ *
+ * Events wait in arrival order while the backend keys their handlers need
+ * are prefetched asynchronously, so lookups for a burst of events are in
+ * flight together instead of one round trip at a time.
+ */
+struct xdd_event {
+    char* action;
+    char* sysname;
+    char* xb_path;
+    char* vif;
+
+    unsigned int outstanding;
+
+    unsigned int attempt;
+    uint64_t deadline;
+    int err;
+
+    /* further teardown events of the same domain, see struct xdd_teardown */
+    struct xdd_event* batch;
+
+    struct xdd_event* next;
+};
+
+struct xdd_prefetch {
+    struct xdd_event* ev;
+    struct xs_cache* cache;
+    char* base_path;
+    const char* key;
+    unsigned int gen;
+};
+
+/* State shared by the main loop and the workers */
+struct xdd_ctx {
+    struct xs_pool* pool;
+    struct xs_cache* cache;
+    struct dev_table* devs;
+    struct timer_queue* timers;
+
+    struct xdd_worker* workers;
+    unsigned int nr_workers;
+
+    unsigned int retry_timeout;
+
+    /* main loop only */
+    unsigned int teardown_window;
+    struct xdd_teardown* teardowns;
+
+    /* events received and not yet freed */
+    unsigned int live;
+};
+
+struct xdd_resync {
+    char* xb_path;
+    char* params;
+    unsigned int domid;
+    unsigned int devid;
+};
+
+struct xdd_retry {
+    struct xdd_ctx* ctx;
+    struct xdd_event* ev;
+};
+
+/*
+ * The main loop's own xenstore connections don't recover by themselves
+ * like the workers' pool: the cache's handle carries its watch and the
+ * async client may have failed to reopen. Both are checked on a timer.
+ */
+struct xdd_xs_check {
+    struct xdd_ctx* ctx;
+    struct xs_async** xa;
+    int down;
+};
+
+/*
+ * Teardown events of a domain (vif offline, vbd remove) arriving within a
+ * short window, handed to a worker as one group. Anything else for the
+ * domain flushes the group first to keep events in order.
+ */
+struct xdd_teardown {
+    unsigned int domid;
+
+    struct xdd_event* head;
+    struct xdd_event** tail;
+
+    struct xdd_ctx* ctx;
+    struct xdd_teardown* next;
+};
+
+/*
+ * Events are spread over the workers by domain, so events for one domain,
+ * and thus for each of its devices, are always handled in order by the
+ * same worker.
+ */
+struct xdd_worker {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    struct xdd_event* head;
+    struct xdd_event** tail;
+    unsigned int depth;
+    int stop;
+
+    struct xdd_ctx* ctx;
+};
+
 struct xdd_conf {
     int help;
     int daemonize;
     int write_pid_file;
     char* pid_file;
+    char* state_file;
+    unsigned int workers;
+    unsigned int retry_timeout;
+    unsigned int teardown_window;
+    unsigned int xs_target;
+    unsigned int rtnl_target;
+    char* inject_socket;
+    char* record_file;
+    char* replay_file;
+    double replay_speed;
+    char* log_target;
+    int log_level;
+    unsigned int log_rate;
+    char* vif_patterns[VIF_BACKEND_MAX];
+    char* vif_backends[VIF_BACKEND_MAX];
+    unsigned int nr_vif_backends;
+    char* ovsdb_socket;
+};
+
+/*
+ * Feeds a recorded trace through the normal event path. Records are
+ * released by a timer so the main loop keeps running in between, with the
+ * recorded gaps divided by speed; a speed of 0 replays as fast as possible.
+ */
+struct xdd_replay {
+    struct trace* trace;
+    double speed;
+
+    uint64_t trace_start;
+    uint64_t start;
+    int started;
+
+    int have_next;
+    uint64_t next_ts;
+    const char* next_buf;
+    size_t next_len;
+
+    int done;
+    unsigned long events;
+
+    struct xdd_event*** tail;
+    struct xs_async** xa;
+    struct xdd_ctx* ctx;
 };
 
+static volatile sig_atomic_t dump_requested;
+static volatile sig_atomic_t stop_requested;
+
 static void init_xdd_conf(struct xdd_conf* conf)
 {
     conf->help = 0;
     conf->daemonize = 0;
     conf->write_pid_file = 0;
     conf->pid_file = "/var/run/xendevd.pid";
+    conf->state_file = "/var/run/xendevd.state";
+    conf->workers = 1;
+    conf->retry_timeout = 30000;
+    conf->teardown_window = 10;
+    conf->xs_target = 5000;
+    conf->rtnl_target = 10000;
+    conf->inject_socket = NULL;
+    conf->record_file = NULL;
+    conf->replay_file = NULL;
+    conf->replay_speed = 1;
+    conf->log_target = NULL;
+    conf->log_level = LOG_INFO;
+    conf->log_rate = 1000;
+    conf->nr_vif_backends = 0;
+    conf->ovsdb_socket = OVS_DEFAULT_SOCKET;
 }
 
 static int parse_args(int argc, char** argv, struct xdd_conf* conf)
@@ -76,12 +285,28 @@ static int parse_args(int argc, char** argv, struct xdd_conf* conf)
         { "help"               , no_argument       , NULL , 'h' },
         { "daemon"             , no_argument       , NULL , 'D' },
         { "pid-file"           , required_argument , NULL , 'p' },
+        { "workers"            , required_argument , NULL , 'w' },
+        { "state-file"         , required_argument , NULL , 's' },
+        { "retry-timeout"      , required_argument , NULL , 'r' },
+        { "teardown-window"    , required_argument , NULL , 'W' },
+        { "xs-target-latency"  , required_argument , NULL , 'x' },
+        { "rtnl-target-latency", required_argument , NULL , 'n' },
+        { "inject-socket"      , required_argument , NULL , 'i' },
+        { "record"             , required_argument , NULL , 'R' },
+        { "replay"             , required_argument , NULL , 'P' },
+        { "replay-speed"       , required_argument , NULL , 'S' },
+        { "log"                , required_argument , NULL , 'l' },
+        { "log-level"          , required_argument , NULL , 'L' },
+        { "log-rate"           , required_argument , NULL , 'T' },
+        { "vif-backend"        , required_argument , NULL , 'V' },
+        { "ovsdb-socket"       , required_argument , NULL , 'O' },
         { NULL , 0 , NULL , 0 }
     };
 
     int opt;
     int opt_index;
     int error = 0;
+    char* sep;
 
     while (1) {
         opt = getopt_long(argc, argv, short_opts, long_opts, &opt_index);
@@ -105,6 +330,92 @@ static int parse_args(int argc, char** argv, struct xdd_conf* conf)
                 conf->pid_file = optarg;
                 break;
 
+            case 'w':
+                conf->workers = strtoul(optarg, NULL, 0);
+                if (conf->workers == 0) {
+                    printf("%s: invalid number of workers \'%s\'\n", argv[0], optarg);
+                    error = 1;
+                }
+                break;
+
+            case 's':
+                conf->state_file = optarg;
+                break;
+
+            case 'r':
+                conf->retry_timeout = strtoul(optarg, NULL, 0);
+                break;
+
+            case 'W':
+                conf->teardown_window = strtoul(optarg, NULL, 0);
+                break;
+
+            case 'x':
+                conf->xs_target = strtoul(optarg, NULL, 0);
+                break;
+
+            case 'n':
+                conf->rtnl_target = strtoul(optarg, NULL, 0);
+                break;
+
+            case 'i':
+                conf->inject_socket = optarg;
+                break;
+
+            case 'R':
+                conf->record_file = optarg;
+                break;
+
+            case 'P':
+                conf->replay_file = optarg;
+                break;
+
+            case 'S':
+                conf->replay_speed = strtod(optarg, NULL);
+                if (conf->replay_speed < 0) {
+                    printf("%s: invalid replay speed \'%s\'\n", argv[0], optarg);
+                    error = 1;
+                }
+                break;
+
+            case 'l':
+                conf->log_target = optarg;
+                break;
+
+            case 'L':
+                conf->log_level = log_level_parse(optarg);
+                if (conf->log_level < 0) {
+                    printf("%s: invalid log level \'%s\'\n", argv[0], optarg);
+                    error = 1;
+                }
+                break;
+
+            case 'T':
+                conf->log_rate = strtoul(optarg, NULL, 0);
+                break;
+
+            case 'V':
+                sep = strrchr(optarg, '=');
+                if (sep == NULL || (strcmp(sep + 1, "bridge") && strcmp(sep + 1, "ovs"))) {
+                    printf("%s: invalid vif backend \'%s\'\n", argv[0], optarg);
+                    error = 1;
+                    break;
+                }
+                if (conf->nr_vif_backends == VIF_BACKEND_MAX) {
+                    printf("%s: too many vif backends\n", argv[0]);
+                    error = 1;
+                    break;
+                }
+                *sep = '\0';
+                conf->vif_patterns[conf->nr_vif_backends] = optarg;
+                conf->vif_backends[conf->nr_vif_backends] = sep + 1;
+                conf->nr_vif_backends++;
+                break;
+
+            case 'O':
+                conf->ovsdb_socket = optarg;
+                break;
+
             default:
                 error = 1;
                 break;
@@ -126,84 +437,346 @@ static void print_usage(char* cmd)
     printf("Usage: %s [OPTION]...\n", cmd);
     printf("\n");
     printf("Options:\n");
-    printf("  -D, --daemon           Run in background\n");
-    printf("  -h, --help             Display this help and exit\n");
-    printf("      --pid-file <file>  Write process pid to file [default: /var/run/xendevd.pid]\n");
+    printf("  -D, --daemon                      Run in background\n");
+    printf("  -h, --help                        Display this help and exit\n");
+    printf("      --pid-file <file>             Write process pid to file [default: /var/run/xendevd.pid]\n");
+    printf("      --workers <n>                 Handle events in n threads [default: 1]\n");
+    printf("      --state-file <file>           Dump device table to file on SIGUSR1 [default: /var/run/xendevd.state]\n");
+    printf("      --retry-timeout <ms>          Give up retrying transient failures after ms [default: 30000]\n");
+    printf("      --teardown-window <ms>        Group a domain's device removals arriving within ms [default: 10]\n");
+    printf("      --xs-target-latency <us>      Throttle xenstore operations above this latency (with --workers > 1), 0 to disable [default: 5000]\n");
+    printf("      --rtnl-target-latency <us>    Throttle link operations above this latency (with --workers > 1), 0 to disable [default: 10000]\n");
+    printf("      --inject-socket <file>        Also accept uevents sent as datagrams to this socket (testing)\n");
+    printf("      --record <file>               Append every received event to a trace file\n");
+    printf("      --replay <file>               Handle the events of a trace instead of udev's, then exit\n");
+    printf("      --replay-speed <n>            Replay n times faster than recorded, 0 for no delays [default: 1]\n");
+    printf("      --log <target>                Log to \"journal\", \"-\" for stderr or a file [default: none]\n");
+    printf("      --log-level <level>           err, warning, notice, info or debug [default: info]\n");
+    printf("      --log-rate <n>                Log at most n records per second, 0 for no limit [default: 1000]\n");
+    printf("      --vif-backend <glob>=<type>   Attach vifs on bridges matching glob with \"bridge\" or \"ovs\", may be\n");
+    printf("                                    repeated, first match wins [default: bridge]\n");
+    printf("      --ovsdb-socket <file>         OVSDB server socket for the ovs backend [default: " OVS_DEFAULT_SOCKET "]\n");
+}
+
+static char* dup_property(struct udev_device* dev, const char* key)
+{
+    const char* value = udev_device_get_property_value(dev, key);
+
+    return value ? strdup(value) : NULL;
+}
+
+static struct xdd_event* event_from_udev(struct udev_device* dev)
+{
+    struct xdd_event* ev;
+    const char* action = udev_device_get_action(dev);
+    const char* sysname = udev_device_get_sysname(dev);
+
+    if (action == NULL || sysname == NULL) {
+        return NULL;
+    }
+
+    ev = calloc(1, sizeof(struct xdd_event));
+    if (ev == NULL) {
+        return NULL;
+    }
+
+    ev->action = strdup(action);
+    ev->sysname = strdup(sysname);
+    ev->xb_path = dup_property(dev, "XENBUS_PATH");
+    ev->vif = dup_property(dev, "vif");
+
+    return ev;
+}
+
+/* Serializes an event in the kernel netlink format, returns 0 if it doesn't fit */
+static size_t uevent_from_udev(struct udev_device* dev, char* buf, size_t size)
+{
+    int n;
+    size_t len;
+    struct udev_list_entry* entry;
+
+    n = snprintf(buf, size, "%s@%s", udev_device_get_action(dev), udev_device_get_devpath(dev));
+    if (n < 0 || n >= size) {
+        return 0;
+    }
+    len = n + 1;
+
+    udev_list_entry_foreach(entry, udev_device_get_properties_list_entry(dev)) {
+        n = snprintf(buf + len, size - len, "%s=%s",
+                udev_list_entry_get_name(entry), udev_list_entry_get_value(entry));
+        if (n < 0 || n >= size - len) {
+            return 0;
+        }
+        len += n + 1;
+    }
+
+    return len;
+}
+
+/*
+ * Parses a uevent in the kernel netlink format, "action@devpath" followed
+ * by NUL separated KEY=value properties. Only xen-backend events are
+ * accepted.
+ */
+static struct xdd_event* event_from_uevent(const char* buf, size_t len)
+{
+    const char* p;
+    const char* end = buf + len;
+    const char* sysname = NULL;
+    const char* subsystem = NULL;
+    struct xdd_event* ev;
+
+    if (len == 0 || buf[len - 1] != '\0') {
+        return NULL;
+    }
+
+    ev = calloc(1, sizeof(struct xdd_event));
+    if (ev == NULL) {
+        return NULL;
+    }
+
+    for (p = buf + strlen(buf) + 1; p < end; p += strlen(p) + 1) {
+        if (strncmp(p, "ACTION=", 7) == 0 && ev->action == NULL) {
+            ev->action = strdup(p + 7);
+        } else if (strncmp(p, "DEVPATH=", 8) == 0) {
+            sysname = strrchr(p + 8, '/');
+            sysname = sysname ? sysname + 1 : p + 8;
+        } else if (strncmp(p, "SUBSYSTEM=", 10) == 0) {
+            subsystem = p + 10;
+        } else if (strncmp(p, "XENBUS_PATH=", 12) == 0 && ev->xb_path == NULL) {
+            ev->xb_path = strdup(p + 12);
+        } else if (strncmp(p, "vif=", 4) == 0 && ev->vif == NULL) {
+            ev->vif = strdup(p + 4);
+        }
+    }
+
+    if (ev->action == NULL || sysname == NULL || *sysname == '\0' ||
+            subsystem == NULL || strcmp(subsystem, "xen-backend") != 0) {
+        free(ev->action);
+        free(ev->xb_path);
+        free(ev->vif);
+        free(ev);
+        return NULL;
+    }
+
+    ev->sysname = strdup(sysname);
+
+    return ev;
+}
+
+static int open_inject_socket(const char* path)
+{
+    int fd;
+    struct sockaddr_un addr;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    unlink(path);
+    if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) || chmod(path, 0600)) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static void free_event(struct xdd_event* ev)
+{
+    free(ev->action);
+    free(ev->sysname);
+    free(ev->xb_path);
+    free(ev->vif);
+    free(ev);
+}
+
+static void release_event(struct xdd_ctx* ctx, struct xdd_event* ev)
+{
+    __atomic_sub_fetch(&ctx->live, 1, __ATOMIC_RELAXED);
+    free_event(ev);
 }
 
-static void do_vif_hotplug(struct xs_handle* xs, struct udev_device* dev)
+/*
+ * Attaches the vif to its bridge, or with the vif-route script routes to
+ * it instead. Either way the device table records what it is attached to,
+ * the bridge or the routed addresses. Returns non-zero if the event failed
+ * transiently and should be retried.
+ */
+static int do_vif_hotplug(struct xs_handle* xs, struct xdd_ctx* ctx, struct xdd_event* ev)
 {
+    int err;
+    int retry = 0;
+    int routed;
     enum operation op;
-    char* bridge = NULL;
-    const char* vif = NULL;
-    const char* xb_path = NULL;
-    const char* action = NULL;
+    char* script = NULL;
+    char* attach = NULL;
+    char* gatewaydev = NULL;
+    unsigned int domid, devid;
+    unsigned int ifindex;
 
-    vif = udev_device_get_property_value(dev, "vif");
-    xb_path = udev_device_get_property_value(dev, "XENBUS_PATH");
-    action = udev_device_get_action(dev);
+    if (ev->vif == NULL || ev->xb_path == NULL) {
+        return 0;
+    }
+
+    if (dev_parse_sysname(ev->sysname, &domid, &devid)) {
+        return 0;
+    }
 
-    if (strcmp(action, "online") == 0) {
+    if (strcmp(ev->action, "online") == 0) {
         op = ONLINE;
-    } else if (strcmp(action, "offline") == 0) {
+    } else if (strcmp(ev->action, "offline") == 0) {
         op = OFFLINE;
     } else {
-        return;
+        return 0;
     }
 
-    bridge = xs_read_k(xs, xb_path, "bridge");
-    if (bridge == NULL) {
-        xs_write_k(xs, "Unable to read bridge from xenstore", xb_path, "hotplug-error");
-        xs_write_k(xs, "error", xb_path, "hotplug-status");
-        return;
+    script = xs_cache_read_k(ctx->cache, xs, ev->xb_path, "script");
+    routed = script && vif_route_selected(script);
+    free(script);
+
+    if (routed) {
+        attach = xs_cache_read_k(ctx->cache, xs, ev->xb_path, "ip");
+        if (attach == NULL) {
+            ev->err = errno;
+            xs_write_k(xs, "Unable to read ip from xenstore", ev->xb_path, "hotplug-error");
+            xs_write_k(xs, "error", ev->xb_path, "hotplug-status");
+            return 0;
+        }
+
+        /* optional */
+        gatewaydev = xs_cache_read_k(ctx->cache, xs, ev->xb_path, "gatewaydev");
+    } else {
+        attach = xs_cache_read_k(ctx->cache, xs, ev->xb_path, "bridge");
+        if (attach == NULL) {
+            ev->err = errno;
+            xs_write_k(xs, "Unable to read bridge from xenstore", ev->xb_path, "hotplug-error");
+            xs_write_k(xs, "error", ev->xb_path, "hotplug-status");
+            return 0;
+        }
     }
 
     switch (op) {
         case ONLINE:
-            vif_hotplug_online(xs, xb_path, bridge, vif);
+            /* a retry is superseded by anything that happened meanwhile */
+            if (ev->attempt &&
+                    dev_table_desired(ctx->devs, DEV_VIF, domid, devid) == DEV_STATE_OFFLINE) {
+                break;
+            }
+            /* a vif recreated under the same name is attached again */
+            ifindex = if_nametoindex(ev->vif);
+            if (dev_table_want(ctx->devs, DEV_VIF, domid, devid, DEV_STATE_ONLINE, attach, ifindex)) {
+                break;
+            }
+
+            if (ev->attempt == 0) {
+                ev->deadline = timer_now_ms() + ctx->retry_timeout;
+            }
+
+            if (routed) {
+                err = vif_route_online(ev->vif, attach, gatewaydev);
+            } else {
+                err = vif_hotplug_attach(xs, ev->xb_path, attach, ev->vif);
+            }
+            ev->err = err;
+            if (err && vif_hotplug_transient(err) && timer_now_ms() < ev->deadline) {
+                dev_table_done(ctx->devs, DEV_VIF, domid, devid, DEV_STATE_FAILED, attach, ifindex, err);
+                retry = 1;
+                break;
+            }
+
+            vif_hotplug_report(xs, ev->xb_path, err);
+            dev_table_done(ctx->devs, DEV_VIF, domid, devid,
+                    err ? DEV_STATE_FAILED : DEV_STATE_ONLINE, attach, ifindex, err);
             break;
         case OFFLINE:
-            vif_hotplug_offline(xs, xb_path, bridge, vif);
+            if (dev_table_want(ctx->devs, DEV_VIF, domid, devid, DEV_STATE_OFFLINE, attach, 0)) {
+                break;
+            }
+            if (routed) {
+                err = vif_route_offline(ev->vif, attach, gatewaydev);
+            } else {
+                err = vif_hotplug_offline(xs, ev->xb_path, attach, ev->vif);
+            }
+            ev->err = err;
+            dev_table_done(ctx->devs, DEV_VIF, domid, devid, DEV_STATE_OFFLINE, attach, 0, err);
+            xs_cache_forget(ctx->cache, ev->xb_path);
             break;
     }
 
-    free(bridge);
+    free(gatewaydev);
+    free(attach);
+
+    return retry;
 }
 
-static void do_vbd_hotplug(struct xs_handle* xs, struct udev_device* dev)
+static void do_vbd_hotplug(struct xs_handle* xs, struct xdd_ctx* ctx, struct xdd_event* ev)
 {
+    int err;
     enum operation op;
     char* device = NULL;
     char* type = NULL;
-    const char* xb_path = NULL;
-    const char* action = NULL;
+    unsigned int domid, devid;
 
-    xb_path = udev_device_get_property_value(dev, "XENBUS_PATH");
-    action = udev_device_get_action(dev);
-
-    if (strcmp(action, "add") == 0) {
-        op = ONLINE;
-    } else {
+    if (ev->xb_path == NULL) {
         return;
     }
 
-    device = xs_read_k(xs, xb_path, "params");
-    if (device == NULL) {
+    if (dev_parse_sysname(ev->sysname, &domid, &devid)) {
         return;
     }
 
-    type = xs_read_k(xs, xb_path, "type");
-    if (type == NULL) {
+    if (strcmp(ev->action, "add") == 0) {
+        op = ONLINE;
+    } else if (strcmp(ev->action, "remove") == 0) {
+        op = OFFLINE;
+    } else {
         return;
     }
 
     switch (op) {
         case ONLINE:
-            if (strcmp(type, "phy") == 0) {
-                vbd_phy_hotplug_online(xs, xb_path, device);
+            device = xs_cache_read_k(ctx->cache, xs, ev->xb_path, "params");
+            if (device == NULL) {
+                ev->err = errno;
+                break;
+            }
+
+            type = xs_cache_read_k(ctx->cache, xs, ev->xb_path, "type");
+            if (type == NULL) {
+                ev->err = errno;
+                break;
             }
+
+            if (strcmp(type, "phy") != 0) {
+                break;
+            }
+            if (dev_table_want(ctx->devs, DEV_VBD, domid, devid, DEV_STATE_ONLINE, device, 0)) {
+                break;
+            }
+            err = vbd_phy_hotplug_online(xs, ev->xb_path, device);
+            ev->err = err;
+            dev_table_done(ctx->devs, DEV_VBD, domid, devid,
+                    err ? DEV_STATE_FAILED : DEV_STATE_ONLINE, device, 0, err);
             break;
         case OFFLINE:
+            /*
+             * Nothing to undo on the host for a phy device. Going offline
+             * releases its entry in the device table, physical-device is
+             * removed along with the domain's other status keys.
+             */
+            dev_table_want(ctx->devs, DEV_VBD, domid, devid, DEV_STATE_OFFLINE, NULL, 0);
+            dev_table_done(ctx->devs, DEV_VBD, domid, devid, DEV_STATE_OFFLINE, NULL, 0, 0);
+            xs_cache_forget(ctx->cache, ev->xb_path);
             break;
     }
 
@@ -211,81 +784,1129 @@ static void do_vbd_hotplug(struct xs_handle* xs, struct udev_device* dev)
     free(type);
 }
 
-
-int main(int argc, char** argv)
+/*
+ * Picks up phy vbds added while the daemon wasn't running. Backends that
+ * were handled before are only recorded in the device table, the others
+ * are validated together in one batch.
+ */
+static void resync_vbds(struct xs_handle* xs, struct xdd_ctx* ctx)
 {
-    int fd = -1;
-    struct udev* udev = NULL;
-    struct udev_monitor* mon = NULL;
-    struct udev_device *dev = NULL;
+    int err;
+    char* path;
+    char* type;
+    char* params;
+    char* phys;
+    char* status;
+    char** doms;
+    char** devs;
+    unsigned int i, j;
+    unsigned int nr_doms, nr_devs;
+    unsigned int n = 0;
+    unsigned int size = 0;
+    struct xdd_resync* todo = NULL;
+    struct xdd_resync* tmp;
+    struct blk_check* checks;
 
-    struct xs_handle *xs = NULL;
+    doms = xs_directory(xs, XBT_NULL, "backend/vbd", &nr_doms);
+    if (doms == NULL) {
+        return;
+    }
 
-    int err;
-    struct xdd_conf conf;
+    for (i = 0; i < nr_doms; i++) {
+        if (asprintf(&path, "backend/vbd/%s", doms[i]) < 0) {
+            continue;
+        }
+        devs = xs_directory(xs, XBT_NULL, path, &nr_devs);
+        free(path);
 
-    FILE* pidf = NULL;
+        for (j = 0; devs && j < nr_devs; j++) {
+            if (asprintf(&path, "backend/vbd/%s/%s", doms[i], devs[j]) < 0) {
+                continue;
+            }
 
+            type = xs_read_k(xs, path, "type");
+            params = xs_read_k(xs, path, "params");
+            phys = xs_read_k(xs, path, "physical-device");
+            status = xs_read_k(xs, path, "hotplug-status");
 
-    /* Parse arguments */
-    init_xdd_conf(&conf);
+            if (type == NULL || params == NULL || strcmp(type, "phy") != 0 || status) {
+                goto next;
+            }
 
-    err = parse_args(argc, argv, &conf);
-    if (err || conf.help) {
-        print_usage(argv[0]);
-        return err ? 1 : 0;
-    }
+            if (phys) {
+                dev_table_want(ctx->devs, DEV_VBD, strtoul(doms[i], NULL, 10),
+                        strtoul(devs[j], NULL, 10), DEV_STATE_ONLINE, params, 0);
+                dev_table_done(ctx->devs, DEV_VBD, strtoul(doms[i], NULL, 10),
+                        strtoul(devs[j], NULL, 10), DEV_STATE_ONLINE, params, 0, 0);
+                goto next;
+            }
 
-    if (conf.write_pid_file) {
-        pidf = fopen(conf.pid_file, "w");
+            if (n == size) {
+                tmp = realloc(todo, (size ? size * 2 : 16) * sizeof(struct xdd_resync));
+                if (tmp == NULL) {
+                    goto next;
+                }
+                todo = tmp;
+                size = size ? size * 2 : 16;
+            }
+
+            todo[n].xb_path = path;
+            todo[n].params = params;
+            todo[n].domid = strtoul(doms[i], NULL, 10);
+            todo[n].devid = strtoul(devs[j], NULL, 10);
+            n++;
+            path = NULL;
+            params = NULL;
+
+next:
+            free(path);
+            free(type);
+            free(params);
+            free(phys);
+            free(status);
+        }
+
+        free(devs);
     }
 
-    if (conf.daemonize) {
-        err = daemon(0, 0);
-        if (err) {
-            printf("Cannot daemonize.");
-            return err;
+    free(doms);
+
+    checks = calloc(n, sizeof(struct blk_check));
+    if (checks) {
+        for (i = 0; i < n; i++) {
+            checks[i].path = todo[i].params;
+        }
+
+        blk_check_batch(checks, n);
+
+        for (i = 0; i < n; i++) {
+            if (dev_table_want(ctx->devs, DEV_VBD, todo[i].domid, todo[i].devid,
+                        DEV_STATE_ONLINE, todo[i].params, 0)) {
+                continue;
+            }
+            err = vbd_phy_hotplug_report(xs, todo[i].xb_path, &checks[i]);
+            dev_table_done(ctx->devs, DEV_VBD, todo[i].domid, todo[i].devid,
+                    err ? DEV_STATE_FAILED : DEV_STATE_ONLINE, todo[i].params, 0, err);
         }
     }
 
-    if (conf.write_pid_file) {
-        fprintf(pidf, "%d", getpid());
-        fclose(pidf);
+    if (n) {
+        log_msg(LOG_INFO, NULL, NULL, 0, "Resynced %u phy vbds", n);
     }
 
+    for (i = 0; i < n; i++) {
+        free(todo[i].xb_path);
+        free(todo[i].params);
+    }
+    free(todo);
+    free(checks);
+}
 
-    /* setup udev */
-    udev = udev_new();
-    mon = udev_monitor_new_from_netlink(udev, "kernel");
+static void log_event(struct xdd_event* ev, int retry)
+{
+    if (ev->err) {
+        log_msg(retry ? LOG_WARNING : LOG_ERR, ev->sysname, ev->xb_path, ev->err,
+                "%s failed%s: %s", ev->action, retry ? ", retrying" : "", strerror(ev->err));
+    } else {
+        log_msg(LOG_INFO, ev->sysname, ev->xb_path, 0, "%s handled", ev->action);
+    }
+}
 
-    udev_monitor_filter_add_match_subsystem_devtype(mon, "xen-backend", NULL);
+static int handle_event(struct xs_handle* xs, struct xdd_ctx* ctx, struct xdd_event* ev)
+{
+    int retry = 0;
 
-    udev_monitor_enable_receiving(mon);
+    ev->err = 0;
 
-    fd = udev_monitor_get_fd(mon);
-    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) & ~O_NONBLOCK);
+    if (strncmp(ev->sysname, "vif-", 4) == 0) {
+        XDD_PROBE3(vif_hotplug_entry, ev->sysname, ev->xb_path, ev->action);
+        retry = do_vif_hotplug(xs, ctx, ev);
+        XDD_PROBE3(vif_hotplug_return, ev->sysname, ev->xb_path, ev->err);
+    } else if (strncmp(ev->sysname, "vbd", 3) == 0) {
+        XDD_PROBE3(vbd_hotplug_entry, ev->sysname, ev->xb_path, ev->action);
+        do_vbd_hotplug(xs, ctx, ev);
+        XDD_PROBE3(vbd_hotplug_return, ev->sysname, ev->xb_path, ev->err);
+    } else {
+        return 0;
+    }
 
+    log_event(ev, retry);
 
-    /* setup xenstore */
-    xs = xs_open(0);
+    return retry;
+}
 
+static int is_teardown(struct xdd_event* ev)
+{
+    if (strncmp(ev->sysname, "vif-", 4) == 0) {
+        return strcmp(ev->action, "offline") == 0;
+    } else if (strncmp(ev->sysname, "vbd", 3) == 0) {
+        return strcmp(ev->action, "remove") == 0;
+    }
 
-    /*  main loop */
-    while (1) {
-        dev = udev_monitor_receive_device(mon);
+    return 0;
+}
 
-        if (dev) {
-            const char* sysname = udev_device_get_sysname(dev);
+/* The bridge of a vif going offline that can be released in a batch */
+static char* vif_batch_bridge(struct xs_handle* xs, struct xdd_ctx* ctx, struct xdd_event* ev)
+{
+    int routed;
+    char* script;
+    char* bridge;
 
-            if (strncmp(sysname, "vif-", 4) == 0) {
-                do_vif_hotplug(xs, dev);
-            } else if (strncmp(sysname, "vbd", 3) == 0) {
-                do_vbd_hotplug(xs, dev);
-            }
+    if (ev->vif == NULL || ev->xb_path == NULL ||
+            strncmp(ev->sysname, "vif-", 4) != 0 || strcmp(ev->action, "offline") != 0) {
+        return NULL;
+    }
 
-            udev_device_unref(dev);
-        }
+    script = xs_cache_read_k(ctx->cache, xs, ev->xb_path, "script");
+    routed = script && vif_route_selected(script);
+    free(script);
+    if (routed) {
+        return NULL;
+    }
+
+    bridge = xs_cache_read_k(ctx->cache, xs, ev->xb_path, "bridge");
+    if (bridge && vif_backend_for(bridge) != &vif_backend_bridge) {
+        free(bridge);
+        return NULL;
     }
 
+    return bridge;
+}
+
+/*
+ * Tears down devices of one domain together. Vifs on Linux bridges are
+ * released in one rtnetlink batch and the rest go through their usual
+ * handlers. The status keys left in the backends are then removed in one
+ * xenstore transaction.
+ */
+static void do_domain_teardown(struct xs_handle* xs, struct xdd_ctx* ctx, struct xdd_event* group)
+{
+    static const char* stale_keys[] = { "hotplug-status", "hotplug-error", "physical-device", NULL };
+
+    unsigned int i;
+    unsigned int n = 0;
+    unsigned int nr_vifs = 0;
+    unsigned int nr_paths = 0;
+    unsigned int domid = 0, devid;
+    char* bridge;
+    char** bridges = NULL;
+    char** paths = NULL;
+    const char** vifs = NULL;
+    int* errs = NULL;
+    struct xdd_event* ev;
+    struct xdd_event** batched = NULL;
+
+    for (ev = group; ev; ev = ev->batch) {
+        n++;
+    }
+
+    dev_parse_sysname(group->sysname, &domid, &devid);
+    XDD_PROBE2(domain_teardown, domid, n);
+
+    bridges = calloc(n, sizeof(char*));
+    paths = calloc(n, sizeof(char*));
+    vifs = calloc(n, sizeof(char*));
+    errs = calloc(n, sizeof(int));
+    batched = calloc(n, sizeof(struct xdd_event*));
+
+    for (ev = group; ev; ev = ev->batch) {
+        ev->err = 0;
+
+        bridge = NULL;
+        if (batched && bridges && vifs && errs && dev_parse_sysname(ev->sysname, &domid, &devid) == 0) {
+            bridge = vif_batch_bridge(xs, ctx, ev);
+        }
+
+        if (bridge == NULL) {
+            handle_event(xs, ctx, ev);
+            continue;
+        }
+
+        if (dev_table_want(ctx->devs, DEV_VIF, domid, devid, DEV_STATE_OFFLINE, bridge, 0)) {
+            free(bridge);
+            log_event(ev, 0);
+            continue;
+        }
+
+        XDD_PROBE3(vif_hotplug_entry, ev->sysname, ev->xb_path, ev->action);
+
+        batched[nr_vifs] = ev;
+        bridges[nr_vifs] = bridge;
+        vifs[nr_vifs] = ev->vif;
+        nr_vifs++;
+    }
+
+    if (nr_vifs) {
+        vif_hotplug_release(vifs, nr_vifs, errs);
+    }
+
+    for (i = 0; i < nr_vifs; i++) {
+        ev = batched[i];
+        ev->err = errs[i];
+
+        dev_parse_sysname(ev->sysname, &domid, &devid);
+        dev_table_done(ctx->devs, DEV_VIF, domid, devid, DEV_STATE_OFFLINE, bridges[i], 0, errs[i]);
+        xs_cache_forget(ctx->cache, ev->xb_path);
+
+        XDD_PROBE3(vif_hotplug_return, ev->sysname, ev->xb_path, ev->err);
+        log_event(ev, 0);
+
+        free(bridges[i]);
+    }
+
+    for (ev = group; paths && ev; ev = ev->batch) {
+        if (ev->err == 0 && ev->xb_path) {
+            paths[nr_paths++] = ev->xb_path;
+        }
+    }
+
+    if (nr_paths && xs_rm_keys_k(xs, paths, nr_paths, stale_keys)) {
+        log_msg(LOG_WARNING, group->sysname, group->xb_path, errno,
+                "Cannot remove status keys of %u devices: %s", nr_paths, strerror(errno));
+    }
+
+    free(bridges);
+    free(paths);
+    free(vifs);
+    free(errs);
+    free(batched);
+}
+
+static void release_group(struct xdd_ctx* ctx, struct xdd_event* ev)
+{
+    struct xdd_event* next;
+
+    while (ev) {
+        next = ev->batch;
+        release_event(ctx, ev);
+        ev = next;
+    }
+}
+
+static void dispatch(struct xdd_ctx* ctx, struct xdd_event* ev);
+
+static void retry_fire(void* arg)
+{
+    struct xdd_retry* r = arg;
+
+    dispatch(r->ctx, r->ev);
+    free(r);
+}
+
+/*
+ * Re-queues the event, or a teardown group with its first event, on a
+ * timer, so the worker moves on meanwhile
+ */
+static void schedule_retry(struct xdd_ctx* ctx, struct xdd_event* ev)
+{
+    unsigned int delay;
+    struct xdd_retry* r;
+
+    delay = RETRY_MIN_MS << (ev->attempt < 6 ? ev->attempt : 6);
+    if (delay > RETRY_MAX_MS) {
+        delay = RETRY_MAX_MS;
+    }
+
+    r = malloc(sizeof(struct xdd_retry));
+    if (r == NULL) {
+        log_msg(LOG_ERR, ev->sysname, ev->xb_path, ENOMEM, "Cannot schedule retry");
+        release_group(ctx, ev);
+        return;
+    }
+
+    r->ctx = ctx;
+    r->ev = ev;
+    ev->attempt++;
+
+    if (timer_add(ctx->timers, delay, retry_fire, r)) {
+        log_msg(LOG_ERR, ev->sysname, ev->xb_path, ENOMEM, "Cannot schedule retry");
+        free(r);
+        release_group(ctx, ev);
+    }
+}
+
+/*
+ * The worker has no xenstore connection (xenstored unreachable, or more
+ * workers than connections), so nothing can be handled or reported. Keep
+ * retrying until the retry timeout, as for transient link errors.
+ */
+static int retry_no_xenstore(struct xdd_ctx* ctx, struct xdd_event* ev, int err)
+{
+    if (ev->attempt == 0) {
+        ev->deadline = timer_now_ms() + ctx->retry_timeout;
+    }
+
+    if (timer_now_ms() < ev->deadline) {
+        log_msg(LOG_WARNING, ev->sysname, ev->xb_path, err,
+                "%s postponed, no xenstore connection: %s", ev->action, strerror(err));
+        return 1;
+    }
+
+    log_msg(LOG_ERR, ev->sysname, ev->xb_path, err,
+            "%s failed, no xenstore connection: %s", ev->action, strerror(err));
+    return 0;
+}
+
+static void* worker_main(void* arg)
+{
+    struct xdd_event* ev;
+    struct xs_handle* xs;
+    struct xdd_worker* w = arg;
+
+    while (1) {
+        pthread_mutex_lock(&w->lock);
+        while (w->head == NULL && !w->stop) {
+            pthread_cond_wait(&w->cond, &w->lock);
+        }
+
+        /* stopping, once the queue is drained */
+        if (w->head == NULL) {
+            pthread_mutex_unlock(&w->lock);
+            break;
+        }
+
+        ev = w->head;
+        w->head = ev->next;
+        if (w->head == NULL) {
+            w->tail = &w->head;
+        }
+        w->depth--;
+        pthread_mutex_unlock(&w->lock);
+
+        xs = xs_pool_get(w->ctx->pool);
+        if (xs == NULL) {
+            if (retry_no_xenstore(w->ctx, ev, errno)) {
+                schedule_retry(w->ctx, ev);
+            } else {
+                release_group(w->ctx, ev);
+            }
+            continue;
+        }
+
+        if (is_teardown(ev)) {
+            do_domain_teardown(xs, w->ctx, ev);
+            release_group(w->ctx, ev);
+            continue;
+        }
+
+        if (handle_event(xs, w->ctx, ev)) {
+            schedule_retry(w->ctx, ev);
+            continue;
+        }
+
+        release_event(w->ctx, ev);
+    }
+
+    return NULL;
+}
+
+static void dispatch(struct xdd_ctx* ctx, struct xdd_event* ev)
+{
+    unsigned int h = 0;
+    unsigned int domid, devid;
+    const char* c;
+    struct xdd_worker* w;
+
+    if (dev_parse_sysname(ev->sysname, &domid, &devid) == 0) {
+        h = domid;
+    } else {
+        for (c = ev->xb_path ? ev->xb_path : ev->sysname; *c; c++) {
+            h = h * 31 + (unsigned char) *c;
+        }
+    }
+    w = &ctx->workers[h % ctx->nr_workers];
+
+    ev->next = NULL;
+
+    pthread_mutex_lock(&w->lock);
+    *w->tail = ev;
+    w->tail = &ev->next;
+    w->depth++;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+static void teardown_flush(struct xdd_ctx* ctx, struct xdd_teardown* td)
+{
+    if (td->head) {
+        dispatch(ctx, td->head);
+        td->head = NULL;
+        td->tail = &td->head;
+    }
+}
+
+static void teardown_fire(void* arg)
+{
+    struct xdd_teardown* td = arg;
+    struct xdd_teardown** t;
+
+    teardown_flush(td->ctx, td);
+
+    for (t = &td->ctx->teardowns; *t != td; t = &(*t)->next);
+    *t = td->next;
+    free(td);
+}
+
+/* Dispatches an event, holding teardown events back to group them by domain */
+static void dispatch_grouped(struct xdd_ctx* ctx, struct xdd_event* ev)
+{
+    unsigned int domid, devid;
+    struct xdd_teardown* td;
+
+    if (dev_parse_sysname(ev->sysname, &domid, &devid)) {
+        dispatch(ctx, ev);
+        return;
+    }
+
+    for (td = ctx->teardowns; td && td->domid != domid; td = td->next);
+
+    if (!is_teardown(ev)) {
+        if (td) {
+            teardown_flush(ctx, td);
+        }
+        dispatch(ctx, ev);
+        return;
+    }
+
+    if (td == NULL) {
+        td = calloc(1, sizeof(struct xdd_teardown));
+        if (td == NULL) {
+            dispatch(ctx, ev);
+            return;
+        }
+
+        td->domid = domid;
+        td->tail = &td->head;
+        td->ctx = ctx;
+
+        if (timer_add(ctx->timers, ctx->teardown_window, teardown_fire, td)) {
+            free(td);
+            dispatch(ctx, ev);
+            return;
+        }
+
+        td->next = ctx->teardowns;
+        ctx->teardowns = td;
+    }
+
+    ev->batch = NULL;
+    *td->tail = ev;
+    td->tail = &ev->batch;
+}
+
+/*
+ * On exit: hands the held teardown groups over and lets the workers finish
+ * their queues, so no thread is left logging once the loop returns.
+ * Retries scheduled meanwhile are dropped, timers no longer run.
+ */
+static void stop_workers(struct xdd_ctx* ctx)
+{
+    unsigned int i;
+    struct xdd_teardown* td;
+
+    for (td = ctx->teardowns; td; td = td->next) {
+        teardown_flush(ctx, td);
+    }
+
+    for (i = 0; i < ctx->nr_workers; i++) {
+        pthread_mutex_lock(&ctx->workers[i].lock);
+        ctx->workers[i].stop = 1;
+        pthread_cond_signal(&ctx->workers[i].cond);
+        pthread_mutex_unlock(&ctx->workers[i].lock);
+    }
+
+    for (i = 0; i < ctx->nr_workers; i++) {
+        pthread_join(ctx->workers[i].thread, NULL);
+    }
+}
+
+static void check_xenstore(struct xdd_xs_check* c)
+{
+    int err;
+    int reconnected;
+
+    err = xs_cache_check(c->ctx->cache, &reconnected);
+    if (err && !c->down) {
+        log_msg(LOG_WARNING, NULL, NULL, err, "Lost xenstore connection: %s", strerror(err));
+    } else if (!err && (c->down || reconnected)) {
+        log_msg(LOG_NOTICE, NULL, NULL, 0, "Reconnected to xenstore");
+    }
+    c->down = err != 0;
+
+    if (*c->xa == NULL) {
+        *c->xa = xs_async_open();
+    }
+}
+
+static void xs_check_fire(void* arg)
+{
+    struct xdd_xs_check* c = arg;
+
+    check_xenstore(c);
+    timer_add(c->ctx->timers, XS_CHECK_MS, xs_check_fire, c);
+}
+
+static const char** event_keys(struct xdd_event* ev)
+{
+    static const char* vif_keys[] = { "script", "bridge", "ip", NULL };
+    static const char* vbd_keys[] = { "params", "type", NULL };
+
+    if (strncmp(ev->sysname, "vif-", 4) == 0) {
+        return vif_keys;
+    } else if (strncmp(ev->sysname, "vbd", 3) == 0 && strcmp(ev->action, "add") == 0) {
+        return vbd_keys;
+    }
+
+    return NULL;
+}
+
+static void prefetch_done(void* arg, int err, const char* value, unsigned int len)
+{
+    struct xdd_prefetch* pf = arg;
+
+    if (!err) {
+        xs_cache_store(pf->cache, pf->base_path, pf->key, value, pf->gen);
+    }
+
+    pf->ev->outstanding--;
+
+    free(pf->base_path);
+    free(pf);
+}
+
+static void prefetch(struct xs_async* xa, struct xs_cache* cache, struct xdd_event* ev)
+{
+    const char** key;
+    unsigned int gen;
+    struct xdd_prefetch* pf;
+
+    key = event_keys(ev);
+
+    if (xa == NULL || key == NULL || ev->xb_path == NULL) {
+        return;
+    }
+
+    for (; *key; key++) {
+        if (!xs_cache_want(cache, ev->xb_path, *key, &gen)) {
+            continue;
+        }
+
+        pf = malloc(sizeof(struct xdd_prefetch));
+        if (pf == NULL) {
+            continue;
+        }
+
+        pf->ev = ev;
+        pf->cache = cache;
+        pf->base_path = strdup(ev->xb_path);
+        pf->key = *key;
+        pf->gen = gen;
+
+        if (xs_read_k_async(xa, ev->xb_path, *key, prefetch_done, pf)) {
+            free(pf->base_path);
+            free(pf);
+            continue;
+        }
+
+        ev->outstanding++;
+    }
+}
+
+/* Queues a received event behind earlier ones and starts its prefetches */
+static void receive_event(struct xdd_ctx* ctx, struct xdd_event* ev,
+        struct xdd_event*** tail, struct xs_async* xa)
+{
+    XDD_PROBE3(event_receive, ev->action, ev->sysname, ev->xb_path);
+    log_msg(LOG_DEBUG, ev->sysname, ev->xb_path, 0, "Received %s", ev->action);
+
+    __atomic_add_fetch(&ctx->live, 1, __ATOMIC_RELAXED);
+
+    **tail = ev;
+    *tail = &ev->next;
+
+    prefetch(xa, ctx->cache, ev);
+}
+
+static void replay_fire(void* arg)
+{
+    int err;
+    unsigned int n = 0;
+    uint64_t due;
+    uint64_t now;
+    struct xdd_event* ev;
+    struct xdd_replay* rp = arg;
+
+    while (1) {
+        if (!rp->have_next) {
+            err = trace_next(rp->trace, &rp->next_ts, &rp->next_buf, &rp->next_len);
+            if (err) {
+                if (err != ENODATA) {
+                    printf("Cannot read trace: %s\n", strerror(err));
+                }
+                rp->done = 1;
+                return;
+            }
+            rp->have_next = 1;
+
+            if (!rp->started) {
+                rp->started = 1;
+                rp->trace_start = rp->next_ts;
+                rp->start = timer_now_ms();
+            }
+        }
+
+        /* also when timed, a burst recorded in one go is due all at once */
+        if (n == REPLAY_BATCH) {
+            timer_add(rp->ctx->timers, 0, replay_fire, rp);
+            return;
+        }
+
+        if (rp->speed > 0) {
+            due = rp->start;
+            if (rp->next_ts > rp->trace_start) {
+                due += (rp->next_ts - rp->trace_start) / 1000000 / rp->speed;
+            }
+
+            now = timer_now_ms();
+            if (due > now) {
+                timer_add(rp->ctx->timers, due - now, replay_fire, rp);
+                return;
+            }
+        }
+
+        rp->have_next = 0;
+        n++;
+
+        ev = event_from_uevent(rp->next_buf, rp->next_len);
+        if (ev) {
+            receive_event(rp->ctx, ev, rp->tail, *rp->xa);
+            rp->events++;
+        }
+    }
+}
+
+static void record_event(struct trace* trace, const char* buf, size_t len)
+{
+    if (trace && len) {
+        trace_append(trace, trace_now_ns(), buf, len);
+    }
+}
+
+/*
+ * Runs from the main loop, so a stuck loop stops the watchdog pings and
+ * systemd restarts the daemon.
+ */
+static void notify_fire(void* arg)
+{
+    unsigned int i;
+    unsigned int live;
+    unsigned int queued = 0;
+    unsigned int interval = notify_watchdog_interval();
+    static unsigned int last_live = -1;
+    static unsigned int last_queued = -1;
+    struct xdd_ctx* ctx = arg;
+
+    if (interval) {
+        notify_send("WATCHDOG=1");
+    }
+
+    for (i = 0; i < ctx->nr_workers; i++) {
+        pthread_mutex_lock(&ctx->workers[i].lock);
+        queued += ctx->workers[i].depth;
+        pthread_mutex_unlock(&ctx->workers[i].lock);
+    }
+    live = __atomic_load_n(&ctx->live, __ATOMIC_RELAXED);
+
+    if (live != last_live || queued != last_queued) {
+        notify_send("STATUS=%u events in flight, %u queued for workers", live, queued);
+        last_live = live;
+        last_queued = queued;
+    }
+
+    timer_add(ctx->timers, interval ? interval : NOTIFY_STATUS_MS, notify_fire, ctx);
+}
+
+static void on_sigusr1(int sig)
+{
+    dump_requested = 1;
+}
+
+static void on_sigterm(int sig)
+{
+    stop_requested = 1;
+}
+
+static void dump_state(struct xdd_ctx* ctx, const char* state_file)
+{
+    FILE* f = fopen(state_file, "w");
+
+    if (f == NULL) {
+        return;
+    }
+
+    dev_table_dump(ctx->devs, f);
+    aimd_dump(f);
+    log_dump(f);
+    fclose(f);
+}
+
+
+int main(int argc, char** argv)
+{
+    int fd = -1;
+    int inject_fd = -1;
+    char* uevent = NULL;
+    ssize_t len;
+    struct trace* record = NULL;
+    struct xdd_replay replay;
+    uint64_t replay_start = 0;
+    struct udev* udev = NULL;
+    struct udev_monitor* mon = NULL;
+    struct udev_device *dev = NULL;
+
+    struct xs_handle *xs = NULL;
+    struct xs_async* xa = NULL;
+    struct xdd_xs_check xs_check;
+    uint64_t deadline;
+    struct xdd_ctx ctx;
+    struct vif_backend* ovs = NULL;
+    struct sigaction sa;
+    sigset_t sigs;
+
+    unsigned int i;
+
+    struct xdd_event* head = NULL;
+    struct xdd_event** tail = &head;
+    struct xdd_event* ev = NULL;
+
+    struct pollfd fds[5];
+    nfds_t nfds;
+    int timeout;
+
+    int err;
+    struct xdd_conf conf;
+
+    FILE* pidf = NULL;
+
+
+    /* Parse arguments */
+    init_xdd_conf(&conf);
+
+    err = parse_args(argc, argv, &conf);
+    if (err || conf.help) {
+        print_usage(argv[0]);
+        return err ? 1 : 0;
+    }
+
+    if (conf.write_pid_file) {
+        pidf = fopen(conf.pid_file, "w");
+    }
+
+    if (conf.daemonize) {
+        err = daemon(0, 0);
+        if (err) {
+            printf("Cannot daemonize.");
+            return err;
+        }
+    }
+
+    if (conf.write_pid_file) {
+        fprintf(pidf, "%d", getpid());
+        fclose(pidf);
+    }
+
+    /* after daemon(), the writer thread would not survive the fork */
+    if (conf.log_target) {
+        err = log_open(conf.log_target, conf.log_level, conf.log_rate);
+        if (err) {
+            printf("Cannot open log %s: %s\n", conf.log_target, strerror(err));
+            return 1;
+        }
+    }
+
+    err = notify_init();
+    if (err) {
+        printf("Cannot connect to NOTIFY_SOCKET: %s\n", strerror(err));
+    }
+
+
+    /* setup udev, replays only see the trace */
+    if (conf.replay_file == NULL) {
+        udev = udev_new();
+        mon = udev_monitor_new_from_netlink(udev, "kernel");
+
+        udev_monitor_filter_add_match_subsystem_devtype(mon, "xen-backend", NULL);
+
+        udev_monitor_enable_receiving(mon);
+
+        fd = udev_monitor_get_fd(mon);
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    }
+
+    uevent = malloc(UEVENT_BUFFER_SIZE);
+
+    if (conf.inject_socket) {
+        inject_fd = open_inject_socket(conf.inject_socket);
+        if (inject_fd < 0 || uevent == NULL) {
+            printf("Cannot open inject socket %s.\n", conf.inject_socket);
+            return 1;
+        }
+    }
+
+
+    /* setup tracing */
+    if (conf.record_file) {
+        record = trace_open_append(conf.record_file);
+        if (record == NULL || uevent == NULL) {
+            printf("Cannot open trace %s.\n", conf.record_file);
+            return 1;
+        }
+    }
+
+    memset(&replay, 0, sizeof(replay));
+    if (conf.replay_file) {
+        replay.trace = trace_open_read(conf.replay_file);
+        if (replay.trace == NULL) {
+            printf("Cannot open trace %s.\n", conf.replay_file);
+            return 1;
+        }
+    }
+
+
+    /* setup xenstore, which may still be starting up */
+    deadline = timer_now_ms() + conf.retry_timeout;
+    while ((xs = xs_open_k()) == NULL && timer_now_ms() < deadline) {
+        usleep(XS_OPEN_WAIT_MS * 1000);
+    }
+    if (xs == NULL) {
+        printf("Cannot connect to xenstore.\n");
+        return 1;
+    }
+
+    /* the cache takes over xs */
+    ctx.cache = xs_cache_new(xs, "backend");
+    if (ctx.cache == NULL) {
+        printf("Cannot create xenstore cache.\n");
+        return 1;
+    }
+
+    /* without the socket (e.g. xenbus only) keys are read synchronously */
+    xa = xs_async_open();
+
+    /* one connection per worker */
+    ctx.pool = xs_pool_new(conf.workers);
+
+    ctx.devs = dev_table_new();
+    ctx.timers = timer_queue_new();
+    ctx.retry_timeout = conf.retry_timeout;
+    ctx.teardown_window = conf.teardown_window;
+    ctx.teardowns = NULL;
+    ctx.live = 0;
+
+    /*
+     * The limit is on workers in the same operation at once, so a single
+     * worker has nothing to throttle.
+     */
+    if (conf.xs_target && conf.workers > 1) {
+        aimd_install(AIMD_XENSTORE, aimd_new(conf.xs_target, 1, conf.workers));
+    }
+    if (conf.rtnl_target && conf.workers > 1) {
+        aimd_install(AIMD_RTNL, aimd_new(conf.rtnl_target, 1, conf.workers));
+    }
+
+    /* one OVSDB connection shared by all ovs bridges */
+    for (i = 0; i < conf.nr_vif_backends; i++) {
+        if (strcmp(conf.vif_backends[i], "ovs") == 0) {
+            if (ovs == NULL) {
+                ovs = ovs_backend_new(conf.ovsdb_socket);
+                if (ovs == NULL) {
+                    printf("Cannot create ovs backend.\n");
+                    return 1;
+                }
+            }
+            vif_backend_map(conf.vif_patterns[i], ovs);
+        } else {
+            vif_backend_map(conf.vif_patterns[i], &vif_backend_bridge);
+        }
+    }
+
+    /* no SA_RESTART, so poll() returns and the dump happens in the main loop */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_sigusr1;
+    sigaction(SIGUSR1, &sa, NULL);
+
+    /* likewise, so pending log records are flushed on exit */
+    sa.sa_handler = on_sigterm;
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+
+    /* a broken xenstore or ovsdb connection is seen as EPIPE instead */
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa, NULL);
+
+
+    /* setup workers, with signals left to the main loop */
+    ctx.workers = calloc(conf.workers, sizeof(struct xdd_worker));
+    ctx.nr_workers = conf.workers;
+
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGUSR1);
+    sigaddset(&sigs, SIGTERM);
+    sigaddset(&sigs, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+    for (i = 0; i < ctx.nr_workers; i++) {
+        pthread_mutex_init(&ctx.workers[i].lock, NULL);
+        pthread_cond_init(&ctx.workers[i].cond, NULL);
+        ctx.workers[i].tail = &ctx.workers[i].head;
+        ctx.workers[i].ctx = &ctx;
+
+        pthread_create(&ctx.workers[i].thread, NULL, worker_main, &ctx.workers[i]);
+    }
+
+    pthread_sigmask(SIG_UNBLOCK, &sigs, NULL);
+
+    if (replay.trace) {
+        replay.speed = conf.replay_speed;
+        replay.tail = &tail;
+        replay.xa = &xa;
+        replay.ctx = &ctx;
+
+        replay_start = timer_now_ms();
+        timer_add(ctx.timers, 0, replay_fire, &replay);
+    }
+
+    /* catch up on devices added before the monitor was receiving */
+    if (conf.replay_file == NULL) {
+        resync_vbds(xs, &ctx);
+    }
+
+    log_msg(LOG_INFO, NULL, NULL, 0, "Started with %u workers", ctx.nr_workers);
+
+    /* the monitor is receiving, events from now on are queued by the kernel */
+    if (notify_enabled()) {
+        notify_send("READY=1\nSTATUS=Waiting for events");
+        timer_add(ctx.timers, notify_watchdog_interval(), notify_fire, &ctx);
+    }
+
+    xs_check.ctx = &ctx;
+    xs_check.xa = &xa;
+    xs_check.down = 0;
+    timer_add(ctx.timers, XS_CHECK_MS, xs_check_fire, &xs_check);
+
+
+    /*  main loop */
+    fds[0].fd = fd;
+    fds[0].events = POLLIN;
+    fds[1].events = POLLIN;
+    fds[2].fd = timer_queue_fileno(ctx.timers);
+    fds[2].events = POLLIN;
+    /* a negative fd is ignored by poll() */
+    fds[3].fd = inject_fd;
+    fds[3].events = POLLIN;
+
+    while (1) {
+        /* changes when the connection is reopened */
+        fds[1].fd = xs_cache_fileno(ctx.cache);
+
+        nfds = 4;
+        if (xa) {
+            fds[4].fd = xs_async_fileno(xa);
+            fds[4].events = xs_async_events(xa);
+            nfds = 5;
+        }
+
+        if (dump_requested) {
+            dump_requested = 0;
+            dump_state(&ctx, conf.state_file);
+        }
+
+        if (stop_requested) {
+            log_msg(LOG_INFO, NULL, NULL, 0, "Exiting");
+            notify_send("STOPPING=1");
+            break;
+        }
+
+        timeout = timer_queue_timeout(ctx.timers);
+
+        /* workers don't wake the loop, so poll for the end of a replay */
+        if (replay.done && (timeout < 0 || timeout > 10)) {
+            timeout = 10;
+        }
+
+        if (poll(fds, nfds, timeout) < 0) {
+            continue;
+        }
+
+        timer_queue_run(ctx.timers);
+
+        /* apply invalidations before handling events that may depend on them */
+        if (fds[1].revents & POLLIN) {
+            xs_cache_handle_watch(ctx.cache);
+        }
+        if (fds[1].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+            check_xenstore(&xs_check);
+        }
+
+        if (fds[0].revents & POLLIN) {
+            while ((dev = udev_monitor_receive_device(mon)) != NULL) {
+                ev = event_from_udev(dev);
+                if (ev && record) {
+                    record_event(record, uevent, uevent_from_udev(dev, uevent, UEVENT_BUFFER_SIZE));
+                }
+                udev_device_unref(dev);
+
+                if (ev == NULL) {
+                    continue;
+                }
+
+                receive_event(&ctx, ev, &tail, xa);
+            }
+        }
+
+        if (fds[3].revents & POLLIN) {
+            while ((len = recv(inject_fd, uevent, UEVENT_BUFFER_SIZE, 0)) >= 0) {
+                ev = event_from_uevent(uevent, len);
+                if (ev) {
+                    record_event(record, uevent, len);
+                    receive_event(&ctx, ev, &tail, xa);
+                }
+            }
+        }
+
+        if (xa && fds[4].revents) {
+            if (xs_async_process(xa)) {
+                /* pending prefetches have been failed, fall back to sync */
+                xs_async_close(xa);
+                xa = xs_async_open();
+            }
+        }
+
+        /* dispatch in arrival order */
+        while (head && head->outstanding == 0) {
+            ev = head;
+            head = ev->next;
+            if (head == NULL) {
+                tail = &head;
+            }
+
+            dispatch_grouped(&ctx, ev);
+        }
+
+        /* a replay is over once every event has been handled */
+        if (replay.done && head == NULL &&
+                __atomic_load_n(&ctx.live, __ATOMIC_RELAXED) == 0) {
+            printf("Replayed %lu events in %.3f s\n", replay.events,
+                    (timer_now_ms() - replay_start) / 1000.0);
+            trace_close(replay.trace);
+            break;
+        }
+    }
+
+    stop_workers(&ctx);
+    log_close();
+
     /* FIXME: remove pid file upon exit*/
+    return 0;
 }
@@ -0,0 +1,208 @@
+/*
+ * xendevd
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *
+ *
+ * Copyright (c) 2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <common/bench.h>
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+
+static char sock_dir[] = "/tmp/xdd-bench.XXXXXX";
+static char sock_path[sizeof(sock_dir) + 16];
+
+
+uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int bench_enter_netns(void)
+{
+    if (unshare(CLONE_NEWNET) < 0) {
+        return errno;
+    }
+
+    return 0;
+}
+
+static int cmp_u64(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*) a;
+    uint64_t y = *(const uint64_t*) b;
+
+    return (x > y) - (x < y);
+}
+
+void bench_sort(uint64_t* samples, unsigned long n)
+{
+    qsort(samples, n, sizeof(uint64_t), cmp_u64);
+}
+
+uint64_t bench_percentile(const uint64_t* sorted, unsigned long n, double p)
+{
+    unsigned long i;
+
+    if (n == 0) {
+        return 0;
+    }
+
+    i = (unsigned long) (p * n);
+    if (i >= n) {
+        i = n - 1;
+    }
+
+    return sorted[i];
+}
+
+void bench_report(const char* name, uint64_t* samples, unsigned long n,
+        unsigned long errors, const char* extra)
+{
+    unsigned long i;
+    uint64_t total = 0;
+
+    for (i = 0; i < n; i++) {
+        total += samples[i];
+    }
+
+    bench_sort(samples, n);
+
+    printf("{\"bench\": \"%s\", \"ops\": %lu, \"errors\": %lu, "
+            "\"ops_per_sec\": %.1f, \"p50_ns\": %lu, \"p99_ns\": %lu, \"p999_ns\": %lu%s%s}\n",
+            name, n, errors, total ? n / (total / 1e9) : 0.0,
+            (unsigned long) bench_percentile(samples, n, 0.50),
+            (unsigned long) bench_percentile(samples, n, 0.99),
+            (unsigned long) bench_percentile(samples, n, 0.999),
+            extra ? ", " : "", extra ? extra : "");
+    fflush(stdout);
+}
+
+static int wait_for_socket(const char* path)
+{
+    int i;
+    int fd;
+    struct sockaddr_un addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    for (i = 0; i < 200; i++) {
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) {
+            return errno;
+        }
+
+        if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) == 0) {
+            close(fd);
+            return 0;
+        }
+
+        close(fd);
+        usleep(10000);
+    }
+
+    return ETIMEDOUT;
+}
+
+pid_t bench_start_xenstored(unsigned long latency_us)
+{
+    pid_t pid;
+    char latency[32];
+    const char* bin;
+
+    if (getenv("XENSTORED_PATH")) {
+        return 0;
+    }
+
+    bin = getenv("FAKE_XENSTORED");
+    if (bin == NULL) {
+        bin = "tools/fake-xenstored";
+    }
+
+    if (mkdtemp(sock_dir) == NULL) {
+        return -1;
+    }
+    snprintf(sock_path, sizeof(sock_path), "%s/socket", sock_dir);
+    snprintf(latency, sizeof(latency), "%lu", latency_us);
+
+    pid = fork();
+    if (pid < 0) {
+        return -1;
+    }
+
+    if (pid == 0) {
+        execl(bin, bin, "--socket", sock_path, "--latency", latency, (char*) NULL);
+        fprintf(stderr, "Cannot run %s: %s\n", bin, strerror(errno));
+        _exit(127);
+    }
+
+    if (wait_for_socket(sock_path)) {
+        bench_stop_xenstored(pid);
+        return -1;
+    }
+
+    setenv("XENSTORED_PATH", sock_path, 1);
+
+    return pid;
+}
+
+void bench_stop_xenstored(pid_t pid)
+{
+    if (pid <= 0) {
+        return;
+    }
+
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+
+    unlink(sock_path);
+    rmdir(sock_dir);
+    unsetenv("XENSTORED_PATH");
+}
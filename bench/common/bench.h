@@ -0,0 +1,74 @@
+/*
+ * xendevd
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *
+ *
+ * Copyright (c) 2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef __BENCH__BENCH__HH__
+#define __BENCH__BENCH__HH__
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <sys/types.h>
+
+
+uint64_t bench_now_ns(void);
+
+/*
+ * Moves the calling process into a fresh network namespace so links can be
+ * created and destroyed without touching the host.
+ */
+int bench_enter_netns(void);
+
+/* Sorts samples in place, percentiles are then read from the sorted array */
+void bench_sort(uint64_t* samples, unsigned long n);
+uint64_t bench_percentile(const uint64_t* sorted, unsigned long n, double p);
+
+/*
+ * Prints one JSON object with the throughput and the p50/p99/p999 of the
+ * given per-operation samples (in ns). The samples are sorted in place.
+ * extra, if not NULL, is appended verbatim as additional JSON members.
+ */
+void bench_report(const char* name, uint64_t* samples, unsigned long n,
+        unsigned long errors, const char* extra);
+
+/*
+ * Starts tools/fake-xenstored (or the binary in $FAKE_XENSTORED) on a
+ * private socket with the given reply latency and points XENSTORED_PATH
+ * at it. If XENSTORED_PATH is already set that xenstored is used instead
+ * and 0 is returned.
+ */
+pid_t bench_start_xenstored(unsigned long latency_us);
+void bench_stop_xenstored(pid_t pid);
+
+#endif /* __BENCH__BENCH__HH__ */
@@ -0,0 +1,310 @@
+/*
+ * xendevd
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *
+ *
+ * Copyright (c) 2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Cost of the link primitives used on the hotplug path. N interfaces and a
+ * few bridges are created in a throwaway network namespace and each
+ * primitive is timed individually. One JSON object is printed per
+ * primitive.
+ */
+
+#include <common/bench.h>
+#include <xdd/bridge.h>
+#include <xdd/iface.h>
+#include <xdd/rtnl.h>
+
+#include <errno.h>
+#include <getopt.h>
+#include <net/if.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+struct bench_conf {
+    int help;
+    unsigned int ifaces;
+    unsigned int bridges;
+    unsigned int rounds;
+};
+
+static void init_bench_conf(struct bench_conf* conf)
+{
+    conf->help = 0;
+    conf->ifaces = 64;
+    conf->bridges = 4;
+    conf->rounds = 50;
+}
+
+static int parse_args(int argc, char** argv, struct bench_conf* conf)
+{
+    const char *short_opts = "hi:b:r:";
+    const struct option long_opts[] = {
+        { "help"               , no_argument       , NULL , 'h' },
+        { "ifaces"             , required_argument , NULL , 'i' },
+        { "bridges"            , required_argument , NULL , 'b' },
+        { "rounds"             , required_argument , NULL , 'r' },
+        { NULL , 0 , NULL , 0 }
+    };
+
+    int opt;
+    int opt_index;
+    int error = 0;
+
+    while (1) {
+        opt = getopt_long(argc, argv, short_opts, long_opts, &opt_index);
+
+        if (opt == -1) {
+            break;
+        }
+
+        switch (opt) {
+            case 'h':
+                conf->help = 1;
+                break;
+
+            case 'i':
+                conf->ifaces = strtoul(optarg, NULL, 0);
+                break;
+
+            case 'b':
+                conf->bridges = strtoul(optarg, NULL, 0);
+                break;
+
+            case 'r':
+                conf->rounds = strtoul(optarg, NULL, 0);
+                break;
+
+            default:
+                error = 1;
+                break;
+        }
+    }
+
+    if (conf->ifaces == 0 || conf->bridges == 0 || conf->rounds == 0) {
+        error = 1;
+    }
+
+    return error;
+}
+
+static void print_usage(char* cmd)
+{
+    printf("Usage: %s [OPTION]...\n", cmd);
+    printf("\n");
+    printf("Options:\n");
+    printf("  -h, --help             Display this help and exit\n");
+    printf("  -i, --ifaces <n>       Number of interfaces [default: 64]\n");
+    printf("  -b, --bridges <n>      Number of bridges [default: 4]\n");
+    printf("  -r, --rounds <n>       Passes over all interfaces [default: 50]\n");
+}
+
+static void if_name(char* buf, unsigned int i)
+{
+    snprintf(buf, IFNAMSIZ, "xddb%u", i);
+}
+
+static void br_name(char* buf, unsigned int i)
+{
+    snprintf(buf, IFNAMSIZ, "xddbr%u", i);
+}
+
+/* Uses dummy links where available and falls back to veth pairs */
+static int create_links(struct rtnl* nl, struct bench_conf* conf, const char** kind)
+{
+    int err;
+    unsigned int i;
+    char name[IFNAMSIZ];
+    char peer[IFNAMSIZ];
+
+    for (i = 0; i < conf->bridges; i++) {
+        br_name(name, i);
+        err = rtnl_link_add(nl, name, "bridge", NULL);
+        if (err) {
+            return err;
+        }
+    }
+
+    *kind = "dummy";
+    for (i = 0; i < conf->ifaces; i++) {
+        if_name(name, i);
+        snprintf(peer, sizeof(peer), "xddp%u", i);
+
+        if (strcmp(*kind, "dummy") == 0) {
+            err = rtnl_link_add(nl, name, "dummy", NULL);
+            if (err == EOPNOTSUPP && i == 0) {
+                *kind = "veth";
+            }
+        }
+        if (strcmp(*kind, "veth") == 0) {
+            err = rtnl_link_add(nl, name, "veth", peer);
+        }
+        if (err) {
+            return err;
+        }
+    }
+
+    return 0;
+}
+
+static void run(struct bench_conf* conf, const char* kind, uint64_t* samples)
+{
+    unsigned int r;
+    unsigned int i;
+    unsigned long n;
+    unsigned long errors;
+    uint64_t start;
+    char extra[128];
+    char dev[IFNAMSIZ];
+    char br[IFNAMSIZ];
+
+    snprintf(extra, sizeof(extra), "\"ifaces\": %u, \"bridges\": %u, \"kind\": \"%s\"",
+            conf->ifaces, conf->bridges, kind);
+
+    /* bridge_add_if and bridge_rem_if alternate so every call does work */
+    n = errors = 0;
+    for (r = 0; r < conf->rounds; r++) {
+        for (i = 0; i < conf->ifaces; i++) {
+            if_name(dev, i);
+            br_name(br, i % conf->bridges);
+
+            start = bench_now_ns();
+            if (bridge_add_if(br, dev)) {
+                errors++;
+            }
+            samples[n++] = bench_now_ns() - start;
+        }
+        for (i = 0; i < conf->ifaces; i++) {
+            if_name(dev, i);
+            br_name(br, i % conf->bridges);
+            bridge_rem_if(br, dev);
+        }
+    }
+    bench_report("bridge_add_if", samples, n, errors, extra);
+
+    n = errors = 0;
+    for (r = 0; r < conf->rounds; r++) {
+        for (i = 0; i < conf->ifaces; i++) {
+            if_name(dev, i);
+            br_name(br, i % conf->bridges);
+            bridge_add_if(br, dev);
+        }
+        for (i = 0; i < conf->ifaces; i++) {
+            if_name(dev, i);
+            br_name(br, i % conf->bridges);
+
+            start = bench_now_ns();
+            if (bridge_rem_if(br, dev)) {
+                errors++;
+            }
+            samples[n++] = bench_now_ns() - start;
+        }
+    }
+    bench_report("bridge_rem_if", samples, n, errors, extra);
+
+    n = errors = 0;
+    for (r = 0; r < conf->rounds; r++) {
+        for (i = 0; i < conf->ifaces; i++) {
+            if_name(dev, i);
+
+            start = bench_now_ns();
+            if (iface_set_up(dev)) {
+                errors++;
+            }
+            samples[n++] = bench_now_ns() - start;
+        }
+        for (i = 0; i < conf->ifaces; i++) {
+            if_name(dev, i);
+            iface_set_down(dev);
+        }
+    }
+    bench_report("iface_set_up", samples, n, errors, extra);
+}
+
+
+int main(int argc, char** argv)
+{
+    int err;
+    const char* kind;
+    uint64_t* samples;
+    struct rtnl* nl;
+    struct bench_conf conf;
+
+
+    /* Parse arguments */
+    init_bench_conf(&conf);
+
+    err = parse_args(argc, argv, &conf);
+    if (err || conf.help) {
+        print_usage(argv[0]);
+        return err ? 1 : 0;
+    }
+
+
+    /* setup links */
+    err = bench_enter_netns();
+    if (err) {
+        fprintf(stderr, "Cannot create network namespace: %s\n", strerror(err));
+        return 1;
+    }
+
+    nl = rtnl_open();
+    if (nl == NULL) {
+        fprintf(stderr, "Cannot open rtnetlink socket.\n");
+        return 1;
+    }
+
+    err = create_links(nl, &conf, &kind);
+    if (err) {
+        fprintf(stderr, "Cannot create links: %s\n", strerror(err));
+        rtnl_close(nl);
+        return 1;
+    }
+
+    samples = calloc((size_t) conf.ifaces * conf.rounds, sizeof(uint64_t));
+    if (samples == NULL) {
+        rtnl_close(nl);
+        return 1;
+    }
+
+
+    /* run; the links go away with the namespace */
+    run(&conf, kind, samples);
+
+    free(samples);
+    rtnl_close(nl);
+
+    return 0;
+}
@@ -0,0 +1,923 @@
+/*
+ * xendevd
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *
+ *
+ * Copyright (c) 2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Boot storm: brings up many guests' worth of backend devices at once and
+ * measures how long xendevd takes to plug them.
+ *
+ * In a private network namespace a bridge and one veth "vif" per guest are
+ * created, plus a loop device that every guest's "phy" vbd points at. The
+ * backend nodes are written to a fake xenstored, xendevd is started with
+ * --inject-socket and xen-backend uevents are sent to it at the requested
+ * rate. A device is done when its backend gets hotplug-status (vif) or
+ * physical-device (vbd). The uevent to done latency distribution, the
+ * throughput and the daemon's CPU time and memory are printed as JSON.
+ *
+ * xendevd's readiness is taken from its sd_notify READY=1. With --resync
+ * the backends exist before xendevd starts, so the vbds are plugged by
+ * its startup scan and the time to READY=1 shows what the scan costs.
+ *
+ * Arguments after "--" are passed to xendevd, e.g. "-- --workers 4".
+ */
+
+#include <common/bench.h>
+#include <xdd/rtnl.h>
+#include <xdd/xs_helper.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <linux/loop.h>
+#include <net/if.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <xenstore.h>
+
+
+#define STORM_BRIDGE    "xenbr0"
+#define STORM_VBD_ID    51712
+
+enum storm_dev_type {
+    STORM_VIF,
+    STORM_VBD,
+};
+
+struct storm_dev {
+    enum storm_dev_type type;
+    unsigned int domid;
+    uint64_t sent;
+    uint64_t done;
+    int failed;
+};
+
+struct storm {
+    struct storm_dev* devs;
+    unsigned int nr_guests;
+    unsigned int nr_devs;
+
+    pthread_mutex_t lock;
+    unsigned int nr_done;
+    unsigned int nr_failed;
+    uint64_t last_done;
+
+    struct xs_handle* watch_xs;
+};
+
+struct bench_conf {
+    int help;
+    unsigned int guests;
+    unsigned int rate;
+    unsigned int timeout;
+    unsigned long latency;
+    int vbd;
+    int resync;
+    char* daemon;
+    char** daemon_args;
+};
+
+static void init_bench_conf(struct bench_conf* conf)
+{
+    conf->help = 0;
+    conf->guests = 500;
+    conf->rate = 0;
+    conf->timeout = 60;
+    conf->latency = 0;
+    conf->vbd = 1;
+    conf->resync = 0;
+    conf->daemon = getenv("XENDEVD");
+    if (conf->daemon == NULL) {
+        conf->daemon = "app/xendevd";
+    }
+    conf->daemon_args = NULL;
+}
+
+static int parse_args(int argc, char** argv, struct bench_conf* conf)
+{
+    const char *short_opts = "hg:r:T:l:";
+    const struct option long_opts[] = {
+        { "help"               , no_argument       , NULL , 'h' },
+        { "guests"             , required_argument , NULL , 'g' },
+        { "rate"               , required_argument , NULL , 'r' },
+        { "timeout"            , required_argument , NULL , 'T' },
+        { "latency"            , required_argument , NULL , 'l' },
+        { "no-vbd"             , no_argument       , NULL , 'V' },
+        { "resync"             , no_argument       , NULL , 'S' },
+        { "daemon"             , required_argument , NULL , 'd' },
+        { NULL , 0 , NULL , 0 }
+    };
+
+    int opt;
+    int opt_index;
+    int error = 0;
+
+    while (1) {
+        opt = getopt_long(argc, argv, short_opts, long_opts, &opt_index);
+
+        if (opt == -1) {
+            break;
+        }
+
+        switch (opt) {
+            case 'h':
+                conf->help = 1;
+                break;
+
+            case 'g':
+                conf->guests = strtoul(optarg, NULL, 0);
+                break;
+
+            case 'r':
+                conf->rate = strtoul(optarg, NULL, 0);
+                break;
+
+            case 'T':
+                conf->timeout = strtoul(optarg, NULL, 0);
+                break;
+
+            case 'l':
+                conf->latency = strtoul(optarg, NULL, 0);
+                break;
+
+            case 'V':
+                conf->vbd = 0;
+                break;
+
+            case 'S':
+                conf->resync = 1;
+                break;
+
+            case 'd':
+                conf->daemon = optarg;
+                break;
+
+            default:
+                error = 1;
+                break;
+        }
+    }
+
+    /* getopt_long stops at "--", the rest belongs to xendevd */
+    conf->daemon_args = &argv[optind];
+
+    if (conf->guests == 0 || conf->timeout == 0) {
+        error = 1;
+    }
+
+    return error;
+}
+
+static void print_usage(char* cmd)
+{
+    printf("Usage: %s [OPTION]... [-- XENDEVD OPTION...]\n", cmd);
+    printf("\n");
+    printf("Options:\n");
+    printf("  -h, --help             Display this help and exit\n");
+    printf("  -g, --guests <n>       Number of guests to start [default: 500]\n");
+    printf("  -r, --rate <n>         Uevents per second, 0 for as fast as possible [default: 0]\n");
+    printf("  -T, --timeout <sec>    Give up waiting for devices after sec [default: 60]\n");
+    printf("  -l, --latency <usec>   Reply latency of the fake xenstored [default: 0]\n");
+    printf("      --no-vbd           Only start vifs\n");
+    printf("      --resync           Create the backends before xendevd starts\n");
+    printf("      --daemon <file>    xendevd binary [default: $XENDEVD or app/xendevd]\n");
+}
+
+
+/* devices */
+
+static int setup_loop(const char* dir, char* loop_dev, size_t len)
+{
+    int ctl;
+    int fd;
+    int loop;
+    int nr;
+    char backing[256];
+
+    snprintf(backing, sizeof(backing), "%s/disk", dir);
+
+    fd = open(backing, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0 || ftruncate(fd, 1 << 20)) {
+        goto out_err;
+    }
+
+    ctl = open("/dev/loop-control", O_RDWR | O_CLOEXEC);
+    if (ctl < 0) {
+        goto out_err;
+    }
+    nr = ioctl(ctl, LOOP_CTL_GET_FREE);
+    close(ctl);
+    if (nr < 0) {
+        goto out_err;
+    }
+
+    snprintf(loop_dev, len, "/dev/loop%d", nr);
+    loop = open(loop_dev, O_RDWR | O_CLOEXEC);
+    if (loop < 0) {
+        goto out_err;
+    }
+
+    if (ioctl(loop, LOOP_SET_FD, fd)) {
+        close(loop);
+        goto out_err;
+    }
+
+    close(fd);
+    unlink(backing);
+
+    return loop;
+
+out_err:
+    if (fd >= 0) {
+        close(fd);
+    }
+    unlink(backing);
+    return -1;
+}
+
+static void teardown_loop(int loop)
+{
+    if (loop >= 0) {
+        ioctl(loop, LOOP_CLR_FD, 0);
+        close(loop);
+    }
+}
+
+static int setup_links(struct bench_conf* conf)
+{
+    int err;
+    unsigned int i;
+    char name[IFNAMSIZ];
+    char peer[IFNAMSIZ];
+    struct rtnl* nl;
+
+    nl = rtnl_open();
+    if (nl == NULL) {
+        return errno;
+    }
+
+    err = rtnl_link_add(nl, STORM_BRIDGE, "bridge", NULL);
+
+    for (i = 0; i < conf->guests && !err; i++) {
+        snprintf(name, sizeof(name), "vif%u.0", i + 1);
+        snprintf(peer, sizeof(peer), "xst%u", i + 1);
+        err = rtnl_link_add(nl, name, "veth", peer);
+    }
+
+    rtnl_close(nl);
+
+    return err;
+}
+
+static int setup_xenstore(struct xs_handle* xs, struct storm* st, const char* loop_dev)
+{
+    unsigned int i;
+    int err = 0;
+    char path[128];
+    char vif[IFNAMSIZ];
+
+    for (i = 0; i < st->nr_devs && !err; i++) {
+        if (st->devs[i].type == STORM_VIF) {
+            snprintf(path, sizeof(path), "backend/vif/%u/0", st->devs[i].domid);
+            snprintf(vif, sizeof(vif), "vif%u.0", st->devs[i].domid);
+
+            err = err || xs_write_k(xs, STORM_BRIDGE, path, "bridge");
+            err = err || xs_write_k(xs, "vif-bridge", path, "script");
+            err = err || xs_write_k(xs, vif, path, "vifname");
+        } else {
+            snprintf(path, sizeof(path), "backend/vbd/%u/%u", st->devs[i].domid, STORM_VBD_ID);
+
+            err = err || xs_write_k(xs, loop_dev, path, "params");
+            err = err || xs_write_k(xs, "phy", path, "type");
+        }
+    }
+
+    return err ? EIO : 0;
+}
+
+
+/* completion */
+
+static struct storm_dev* dev_from_path(struct storm* st, const char* path, const char** key)
+{
+    unsigned int domid;
+    unsigned int devid;
+    int n = 0;
+    char type[4];
+
+    if (sscanf(path, "/local/domain/0/backend/%3[a-z]/%u/%u/%n", type, &domid, &devid, &n) != 3 || n == 0) {
+        return NULL;
+    }
+    if (domid == 0 || domid > st->nr_guests) {
+        return NULL;
+    }
+
+    *key = path + n;
+
+    if (strcmp(type, "vif") == 0) {
+        return &st->devs[domid - 1];
+    } else if (strcmp(type, "vbd") == 0 && st->nr_devs > st->nr_guests) {
+        return &st->devs[st->nr_guests + domid - 1];
+    }
+
+    return NULL;
+}
+
+static void* watch_main(void* arg)
+{
+    char** vec;
+    char* value;
+    const char* key;
+    unsigned int num;
+    uint64_t now;
+    struct storm_dev* dev;
+    struct storm* st = arg;
+    struct xs_handle* xs = st->watch_xs;
+
+    while ((vec = xs_read_watch(xs, &num)) != NULL) {
+        now = bench_now_ns();
+
+        dev = dev_from_path(st, vec[XS_WATCH_PATH], &key);
+        if (dev == NULL || dev->sent == 0) {
+            free(vec);
+            continue;
+        }
+
+        if (strcmp(key, "hotplug-status") == 0) {
+            value = xs_read(xs, XBT_NULL, vec[XS_WATCH_PATH], NULL);
+        } else if (strcmp(key, "physical-device") == 0) {
+            value = strdup("connected");
+        } else {
+            value = NULL;
+        }
+
+        pthread_mutex_lock(&st->lock);
+        if (value && dev->done == 0) {
+            dev->done = now;
+            dev->failed = strcmp(value, "connected") != 0;
+            st->nr_done++;
+            st->nr_failed += dev->failed;
+            st->last_done = now;
+        }
+        pthread_mutex_unlock(&st->lock);
+
+        free(value);
+        free(vec);
+    }
+
+    return NULL;
+}
+
+
+/* Marks the vbds the startup scan plugged as done when xendevd got ready */
+static void collect_resynced(struct xs_handle* xs, struct storm* st, uint64_t start, uint64_t ready)
+{
+    unsigned int i;
+    char* value;
+    char path[128];
+    struct storm_dev* dev;
+
+    for (i = st->nr_guests; i < st->nr_devs; i++) {
+        dev = &st->devs[i];
+
+        snprintf(path, sizeof(path), "backend/vbd/%u/%u", dev->domid, STORM_VBD_ID);
+        value = xs_read_k(xs, path, "physical-device");
+        if (value == NULL) {
+            value = xs_read_k(xs, path, "hotplug-status");
+        }
+        if (value == NULL) {
+            continue;
+        }
+
+        pthread_mutex_lock(&st->lock);
+        dev->sent = start;
+        dev->done = ready;
+        dev->failed = strchr(value, ':') == NULL;
+        st->nr_done++;
+        st->nr_failed += dev->failed;
+        pthread_mutex_unlock(&st->lock);
+
+        free(value);
+    }
+}
+
+
+/* injection */
+
+static int format_uevent(struct storm_dev* dev, char* buf, size_t len)
+{
+    int n;
+
+    if (dev->type == STORM_VIF) {
+        n = snprintf(buf, len,
+                "online@/devices/vif-%u-0%c"
+                "ACTION=online%c"
+                "DEVPATH=/devices/vif-%u-0%c"
+                "SUBSYSTEM=xen-backend%c"
+                "XENBUS_PATH=backend/vif/%u/0%c"
+                "vif=vif%u.0%c",
+                dev->domid, 0, 0, dev->domid, 0, 0, dev->domid, 0, dev->domid, 0);
+    } else {
+        n = snprintf(buf, len,
+                "add@/devices/vbd-%u-%u%c"
+                "ACTION=add%c"
+                "DEVPATH=/devices/vbd-%u-%u%c"
+                "SUBSYSTEM=xen-backend%c"
+                "XENBUS_PATH=backend/vbd/%u/%u%c",
+                dev->domid, STORM_VBD_ID, 0, 0, dev->domid, STORM_VBD_ID, 0, 0,
+                dev->domid, STORM_VBD_ID, 0);
+    }
+
+    return n < len ? n + 1 : -1;
+}
+
+static int connect_inject(const char* path)
+{
+    int i;
+    int fd;
+    struct sockaddr_un addr;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    for (i = 0; i < 500; i++) {
+        if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) == 0) {
+            return fd;
+        }
+        usleep(10000);
+    }
+
+    close(fd);
+    return -1;
+}
+
+static void inject(int fd, struct storm* st, unsigned int rate)
+{
+    int len;
+    unsigned int i;
+    unsigned int n;
+    struct storm_dev* dev;
+    uint64_t start;
+    uint64_t due;
+    uint64_t now;
+    struct timespec ts;
+    char buf[512];
+
+    start = bench_now_ns();
+
+    /* the devices of a guest are sent back to back, like a real domain build */
+    n = st->nr_devs / st->nr_guests;
+    for (i = 0; i < st->nr_devs; i++) {
+        dev = &st->devs[(i % n) * st->nr_guests + i / n];
+        if (dev->sent) {
+            continue;
+        }
+
+        if (rate) {
+            due = start + (uint64_t) i * 1000000000 / rate;
+            now = bench_now_ns();
+            if (due > now) {
+                ts.tv_sec = (due - now) / 1000000000;
+                ts.tv_nsec = (due - now) % 1000000000;
+                nanosleep(&ts, NULL);
+            }
+        }
+
+        len = format_uevent(dev, buf, sizeof(buf));
+        if (len < 0) {
+            continue;
+        }
+
+        pthread_mutex_lock(&st->lock);
+        dev->sent = bench_now_ns();
+        pthread_mutex_unlock(&st->lock);
+
+        if (send(fd, buf, len, 0) < 0) {
+            fprintf(stderr, "Cannot inject uevent: %s\n", strerror(errno));
+        }
+    }
+}
+
+
+/* daemon */
+
+static int open_notify(const char* dir, char* path, size_t len)
+{
+    int fd;
+    struct sockaddr_un addr;
+
+    snprintf(path, len, "%s/notify", dir);
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (bind(fd, (struct sockaddr*) &addr, sizeof(addr))) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/* Waits for READY=1 on the notify socket */
+static int wait_ready(int fd, unsigned int timeout)
+{
+    ssize_t n;
+    char buf[256];
+    struct timeval tv;
+
+    tv.tv_sec = timeout;
+    tv.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    while ((n = recv(fd, buf, sizeof(buf) - 1, 0)) >= 0) {
+        buf[n] = '\0';
+        if (strncmp(buf, "READY=1", 7) == 0 || strstr(buf, "\nREADY=1")) {
+            return 0;
+        }
+    }
+
+    return errno;
+}
+
+static pid_t start_daemon(struct bench_conf* conf, const char* dir, char* sock, size_t len,
+        const char* notify)
+{
+    pid_t pid;
+    char** argv;
+    unsigned int i;
+    unsigned int n = 0;
+    char state[256];
+
+    snprintf(sock, len, "%s/inject", dir);
+    snprintf(state, sizeof(state), "%s/state", dir);
+
+    while (conf->daemon_args[n]) {
+        n++;
+    }
+
+    argv = calloc(n + 6, sizeof(char*));
+    if (argv == NULL) {
+        return -1;
+    }
+
+    argv[0] = conf->daemon;
+    argv[1] = "--inject-socket";
+    argv[2] = sock;
+    argv[3] = "--state-file";
+    argv[4] = state;
+    for (i = 0; i < n; i++) {
+        argv[5 + i] = conf->daemon_args[i];
+    }
+
+    pid = fork();
+    if (pid == 0) {
+        setenv("NOTIFY_SOCKET", notify, 1);
+        execv(conf->daemon, argv);
+        fprintf(stderr, "Cannot run %s: %s\n", conf->daemon, strerror(errno));
+        _exit(127);
+    }
+
+    free(argv);
+
+    return pid;
+}
+
+/* CPU time of a process in seconds */
+static double proc_cpu(pid_t pid)
+{
+    FILE* f;
+    char* p;
+    char buf[1024];
+    unsigned long utime = 0;
+    unsigned long stime = 0;
+
+    snprintf(buf, sizeof(buf), "/proc/%d/stat", pid);
+    f = fopen(buf, "r");
+    if (f == NULL) {
+        return 0;
+    }
+
+    p = fgets(buf, sizeof(buf), f);
+    fclose(f);
+
+    /* the command name may contain spaces, fields are counted after it */
+    if (p == NULL || (p = strrchr(buf, ')')) == NULL) {
+        return 0;
+    }
+    sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime);
+
+    return (double) (utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+/* A memory field of /proc/<pid>/status in kB */
+static unsigned long proc_mem(pid_t pid, const char* field)
+{
+    FILE* f;
+    char buf[256];
+    unsigned long kb = 0;
+    size_t len = strlen(field);
+
+    snprintf(buf, sizeof(buf), "/proc/%d/status", pid);
+    f = fopen(buf, "r");
+    if (f == NULL) {
+        return 0;
+    }
+
+    while (fgets(buf, sizeof(buf), f)) {
+        if (strncmp(buf, field, len) == 0 && buf[len] == ':') {
+            kb = strtoul(buf + len + 1, NULL, 10);
+            break;
+        }
+    }
+    fclose(f);
+
+    return kb;
+}
+
+
+static void report(struct storm* st, struct bench_conf* conf, uint64_t start,
+        uint64_t startup, double cpu, unsigned long rss, unsigned long hwm)
+{
+    unsigned int i;
+    unsigned long n = 0;
+    uint64_t* samples;
+    double secs;
+
+    samples = calloc(st->nr_devs, sizeof(uint64_t));
+    if (samples == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&st->lock);
+    for (i = 0; i < st->nr_devs; i++) {
+        if (st->devs[i].done) {
+            samples[n++] = st->devs[i].done - st->devs[i].sent;
+        }
+    }
+    secs = st->nr_done ? (st->last_done - start) / 1e9 : 0;
+    pthread_mutex_unlock(&st->lock);
+
+    bench_sort(samples, n);
+
+    printf("{\"bench\": \"storm\", \"guests\": %u, \"events\": %u, \"completed\": %lu, \"failed\": %u, "
+            "\"rate\": %u, \"resync\": %s, \"startup_ns\": %lu, \"secs\": %.6f, \"events_per_sec\": %.1f, "
+            "\"p50_ns\": %lu, \"p99_ns\": %lu, \"p999_ns\": %lu, \"max_ns\": %lu, "
+            "\"cpu_secs\": %.2f, \"cpu_util\": %.3f, \"rss_kb\": %lu, \"hwm_kb\": %lu}\n",
+            st->nr_guests, st->nr_devs, n, st->nr_failed,
+            conf->rate, conf->resync ? "true" : "false", (unsigned long) startup,
+            secs, secs > 0 ? n / secs : 0.0,
+            (unsigned long) bench_percentile(samples, n, 0.50),
+            (unsigned long) bench_percentile(samples, n, 0.99),
+            (unsigned long) bench_percentile(samples, n, 0.999),
+            n ? (unsigned long) samples[n - 1] : 0,
+            cpu, secs > 0 ? cpu / secs : 0.0, rss, hwm);
+
+    free(samples);
+}
+
+
+int main(int argc, char** argv)
+{
+    int err;
+    int fd = -1;
+    int notify_fd = -1;
+    int loop = -1;
+    unsigned int i;
+    pid_t xsd;
+    pid_t daemon = -1;
+    uint64_t start;
+    uint64_t launch;
+    uint64_t ready;
+    uint64_t deadline;
+    double cpu;
+    unsigned long rss;
+    unsigned long hwm;
+    pthread_t watcher;
+    struct xs_handle* xs = NULL;
+    struct storm st;
+    struct bench_conf conf;
+    char dir[] = "/tmp/xdd-storm.XXXXXX";
+    char loop_dev[32] = "";
+    char sock[256] = "";
+    char notify[256] = "";
+
+
+    /* Parse arguments */
+    init_bench_conf(&conf);
+
+    err = parse_args(argc, argv, &conf);
+    if (err || conf.help) {
+        print_usage(argv[0]);
+        return err ? 1 : 0;
+    }
+
+    memset(&st, 0, sizeof(st));
+    pthread_mutex_init(&st.lock, NULL);
+    st.nr_guests = conf.guests;
+    st.nr_devs = conf.guests * (conf.vbd ? 2 : 1);
+    st.devs = calloc(st.nr_devs, sizeof(struct storm_dev));
+    if (st.devs == NULL || mkdtemp(dir) == NULL) {
+        return 1;
+    }
+
+    for (i = 0; i < st.nr_devs; i++) {
+        st.devs[i].type = i < conf.guests ? STORM_VIF : STORM_VBD;
+        st.devs[i].domid = i % conf.guests + 1;
+    }
+
+
+    /* setup devices, the daemon inherits the namespace */
+    err = bench_enter_netns();
+    if (err) {
+        fprintf(stderr, "Cannot create network namespace: %s\n", strerror(err));
+        goto out;
+    }
+
+    err = setup_links(&conf);
+    if (err) {
+        fprintf(stderr, "Cannot create links: %s\n", strerror(err));
+        goto out;
+    }
+
+    if (conf.vbd) {
+        loop = setup_loop(dir, loop_dev, sizeof(loop_dev));
+        if (loop < 0) {
+            fprintf(stderr, "Cannot set up loop device.\n");
+            err = 1;
+            goto out;
+        }
+    }
+
+
+    /* setup xenstore */
+    xsd = bench_start_xenstored(conf.latency);
+    if (xsd < 0) {
+        fprintf(stderr, "Cannot start fake xenstored.\n");
+        err = 1;
+        goto out;
+    }
+
+    xs = xs_open_k();
+    st.watch_xs = xs_open_k();
+    if (xs == NULL || st.watch_xs == NULL || (conf.resync && setup_xenstore(xs, &st, loop_dev))) {
+        fprintf(stderr, "Cannot write to xenstore.\n");
+        err = 1;
+        goto out_xsd;
+    }
+
+
+    /* run */
+    notify_fd = open_notify(dir, notify, sizeof(notify));
+    launch = start = bench_now_ns();
+    daemon = notify_fd >= 0 ? start_daemon(&conf, dir, sock, sizeof(sock), notify) : -1;
+    if (daemon < 0 || wait_ready(notify_fd, conf.timeout)) {
+        fprintf(stderr, "xendevd did not get ready.\n");
+        err = 1;
+        goto out_daemon;
+    }
+    ready = bench_now_ns();
+
+    fd = connect_inject(sock);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot reach xendevd.\n");
+        err = 1;
+        goto out_daemon;
+    }
+
+    if (conf.resync) {
+        collect_resynced(xs, &st, start, ready);
+    } else if (setup_xenstore(xs, &st, loop_dev)) {
+        fprintf(stderr, "Cannot write to xenstore.\n");
+        err = 1;
+        goto out_daemon;
+    }
+
+    /* watch before injecting, so no completion is missed */
+    if (!xs_watch(st.watch_xs, "/local/domain/0/backend", "storm")) {
+        fprintf(stderr, "Cannot watch xenstore.\n");
+        err = 1;
+        goto out_daemon;
+    }
+    pthread_create(&watcher, NULL, watch_main, &st);
+
+    /* the resync run counts the startup scan */
+    cpu = conf.resync ? 0 : proc_cpu(daemon);
+    if (!conf.resync) {
+        start = bench_now_ns();
+    }
+
+    inject(fd, &st, conf.rate);
+
+    deadline = bench_now_ns() + (uint64_t) conf.timeout * 1000000000;
+    while (bench_now_ns() < deadline) {
+        pthread_mutex_lock(&st.lock);
+        i = st.nr_done;
+        pthread_mutex_unlock(&st.lock);
+
+        if (i == st.nr_devs) {
+            break;
+        }
+        usleep(1000);
+    }
+
+    cpu = proc_cpu(daemon) - cpu;
+    rss = proc_mem(daemon, "VmRSS");
+    hwm = proc_mem(daemon, "VmHWM");
+
+    report(&st, &conf, start, ready - launch, cpu, rss, hwm);
+
+    if (st.nr_done < st.nr_devs) {
+        fprintf(stderr, "%u of %u devices did not complete.\n", st.nr_devs - st.nr_done, st.nr_devs);
+        err = 1;
+    }
+
+    /* the watcher blocks in xs_read_watch and goes away with the process */
+
+out_daemon:
+    if (daemon > 0) {
+        kill(daemon, SIGTERM);
+        waitpid(daemon, NULL, 0);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (notify_fd >= 0) {
+        close(notify_fd);
+        unlink(notify);
+    }
+    unlink(sock);
+out_xsd:
+    if (xs) {
+        xs_close(xs);
+    }
+    /* the watcher may still be using its handle, it goes away with the process */
+    bench_stop_xenstored(xsd);
+out:
+    teardown_loop(loop);
+    snprintf(sock, sizeof(sock), "%s/state", dir);
+    unlink(sock);
+    rmdir(dir);
+    free(st.devs);
+
+    return err ? 1 : 0;
+}
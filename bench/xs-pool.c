@@ -0,0 +1,255 @@
+/*
+ * xendevd
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *
+ *
+ * Copyright (c) 2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Throughput of xs_pool_read_k as the number of pooled handles (and
+ * threads using them) grows. One JSON object is printed per handle count.
+ */
+
+#include <common/bench.h>
+#include <xdd/xs_helper.h>
+
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xenstore.h>
+
+
+#define BENCH_PATH  "/local/domain/0/xdd-bench"
+
+struct bench_conf {
+    int help;
+    unsigned long ops;
+    unsigned int max_handles;
+    unsigned long latency;
+};
+
+struct bench_thread {
+    pthread_t thread;
+    struct xs_pool* pool;
+    pthread_barrier_t* warm;
+    unsigned long ops;
+    unsigned long errors;
+};
+
+static void init_bench_conf(struct bench_conf* conf)
+{
+    conf->help = 0;
+    conf->ops = 5000;
+    conf->max_handles = 16;
+    conf->latency = 100;
+}
+
+static int parse_args(int argc, char** argv, struct bench_conf* conf)
+{
+    const char *short_opts = "hn:t:l:";
+    const struct option long_opts[] = {
+        { "help"               , no_argument       , NULL , 'h' },
+        { "ops"                , required_argument , NULL , 'n' },
+        { "handles"            , required_argument , NULL , 't' },
+        { "latency"            , required_argument , NULL , 'l' },
+        { NULL , 0 , NULL , 0 }
+    };
+
+    int opt;
+    int opt_index;
+    int error = 0;
+
+    while (1) {
+        opt = getopt_long(argc, argv, short_opts, long_opts, &opt_index);
+
+        if (opt == -1) {
+            break;
+        }
+
+        switch (opt) {
+            case 'h':
+                conf->help = 1;
+                break;
+
+            case 'n':
+                conf->ops = strtoul(optarg, NULL, 0);
+                break;
+
+            case 't':
+                conf->max_handles = strtoul(optarg, NULL, 0);
+                break;
+
+            case 'l':
+                conf->latency = strtoul(optarg, NULL, 0);
+                break;
+
+            default:
+                error = 1;
+                break;
+        }
+    }
+
+    if (conf->ops == 0 || conf->max_handles == 0) {
+        error = 1;
+    }
+
+    return error;
+}
+
+static void print_usage(char* cmd)
+{
+    printf("Usage: %s [OPTION]...\n", cmd);
+    printf("\n");
+    printf("Options:\n");
+    printf("  -h, --help             Display this help and exit\n");
+    printf("  -n, --ops <n>          Total reads per run [default: 5000]\n");
+    printf("  -t, --handles <n>      Largest pool size to try [default: 16]\n");
+    printf("  -l, --latency <usec>   Reply latency of the fake xenstored [default: 100]\n");
+}
+
+static void* bench_thread_main(void* arg)
+{
+    char* value;
+    unsigned long i;
+    struct bench_thread* t = arg;
+
+    /* open this thread's connection before the clock starts */
+    free(xs_pool_read_k(t->pool, BENCH_PATH, "key"));
+    pthread_barrier_wait(t->warm);
+
+    for (i = 0; i < t->ops; i++) {
+        value = xs_pool_read_k(t->pool, BENCH_PATH, "key");
+        if (value == NULL) {
+            t->errors++;
+        }
+        free(value);
+    }
+
+    return NULL;
+}
+
+static int run(unsigned int handles, unsigned long ops)
+{
+    unsigned int i;
+    uint64_t start;
+    uint64_t elapsed;
+    unsigned long errors = 0;
+    struct xs_pool* pool;
+    struct bench_thread* threads;
+    pthread_barrier_t warm;
+
+    pool = xs_pool_new(handles);
+    threads = calloc(handles, sizeof(struct bench_thread));
+    if (pool == NULL || threads == NULL) {
+        return -1;
+    }
+
+    /* threads keep their pool slot, so they warm up and run in one go */
+    pthread_barrier_init(&warm, NULL, handles + 1);
+
+    for (i = 0; i < handles; i++) {
+        threads[i].pool = pool;
+        threads[i].warm = &warm;
+        threads[i].ops = ops / handles;
+        pthread_create(&threads[i].thread, NULL, bench_thread_main, &threads[i]);
+    }
+
+    pthread_barrier_wait(&warm);
+    start = bench_now_ns();
+
+    for (i = 0; i < handles; i++) {
+        pthread_join(threads[i].thread, NULL);
+        errors += threads[i].errors;
+    }
+
+    elapsed = bench_now_ns() - start;
+
+    printf("{\"bench\": \"xs_pool_read_k\", \"handles\": %u, \"ops\": %lu, \"errors\": %lu, "
+            "\"secs\": %.6f, \"ops_per_sec\": %.1f}\n",
+            handles, ops / handles * handles, errors,
+            elapsed / 1e9, (ops / handles * handles) / (elapsed / 1e9));
+
+    pthread_barrier_destroy(&warm);
+    xs_pool_free(pool);
+    free(threads);
+
+    return 0;
+}
+
+
+int main(int argc, char** argv)
+{
+    int err;
+    pid_t xsd;
+    unsigned int handles;
+    struct xs_handle* xs;
+    struct bench_conf conf;
+
+
+    /* Parse arguments */
+    init_bench_conf(&conf);
+
+    err = parse_args(argc, argv, &conf);
+    if (err || conf.help) {
+        print_usage(argv[0]);
+        return err ? 1 : 0;
+    }
+
+
+    /* setup xenstore */
+    xsd = bench_start_xenstored(conf.latency);
+    if (xsd < 0) {
+        fprintf(stderr, "Cannot start fake xenstored.\n");
+        return 1;
+    }
+
+    xs = xs_open_k();
+    if (xs == NULL || xs_write_k(xs, "value", BENCH_PATH, "key")) {
+        fprintf(stderr, "Cannot write to xenstore.\n");
+        bench_stop_xenstored(xsd);
+        return 1;
+    }
+
+
+    /* run */
+    for (handles = 1; handles <= conf.max_handles; handles *= 2) {
+        run(handles, conf.ops);
+    }
+
+    xs_rm(xs, XBT_NULL, BENCH_PATH);
+    xs_close(xs);
+
+    bench_stop_xenstored(xsd);
+
+    return 0;
+}
@@ -0,0 +1,226 @@
+/*
+ * xendevd
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *
+ *
+ * Copyright (c) 2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Latency of single xs_read_k and xs_write_k calls against a local
+ * stand-in xenstored. One JSON object is printed per primitive.
+ */
+
+#include <common/bench.h>
+#include <xdd/xs_helper.h>
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xenstore.h>
+
+
+#define BENCH_PATH  "/local/domain/0/xdd-bench"
+
+struct bench_conf {
+    int help;
+    unsigned long ops;
+    unsigned int keys;
+    unsigned long latency;
+};
+
+static void init_bench_conf(struct bench_conf* conf)
+{
+    conf->help = 0;
+    conf->ops = 10000;
+    conf->keys = 64;
+    conf->latency = 0;
+}
+
+static int parse_args(int argc, char** argv, struct bench_conf* conf)
+{
+    const char *short_opts = "hn:k:l:";
+    const struct option long_opts[] = {
+        { "help"               , no_argument       , NULL , 'h' },
+        { "ops"                , required_argument , NULL , 'n' },
+        { "keys"               , required_argument , NULL , 'k' },
+        { "latency"            , required_argument , NULL , 'l' },
+        { NULL , 0 , NULL , 0 }
+    };
+
+    int opt;
+    int opt_index;
+    int error = 0;
+
+    while (1) {
+        opt = getopt_long(argc, argv, short_opts, long_opts, &opt_index);
+
+        if (opt == -1) {
+            break;
+        }
+
+        switch (opt) {
+            case 'h':
+                conf->help = 1;
+                break;
+
+            case 'n':
+                conf->ops = strtoul(optarg, NULL, 0);
+                break;
+
+            case 'k':
+                conf->keys = strtoul(optarg, NULL, 0);
+                break;
+
+            case 'l':
+                conf->latency = strtoul(optarg, NULL, 0);
+                break;
+
+            default:
+                error = 1;
+                break;
+        }
+    }
+
+    if (conf->ops == 0 || conf->keys == 0) {
+        error = 1;
+    }
+
+    return error;
+}
+
+static void print_usage(char* cmd)
+{
+    printf("Usage: %s [OPTION]...\n", cmd);
+    printf("\n");
+    printf("Options:\n");
+    printf("  -h, --help             Display this help and exit\n");
+    printf("  -n, --ops <n>          Calls per primitive [default: 10000]\n");
+    printf("  -k, --keys <n>         Number of distinct keys [default: 64]\n");
+    printf("  -l, --latency <usec>   Reply latency of the fake xenstored [default: 0]\n");
+}
+
+static void run(struct xs_handle* xs, struct bench_conf* conf, uint64_t* samples)
+{
+    int err;
+    char* value;
+    char key[32];
+    char extra[64];
+    unsigned long i;
+    unsigned long errors;
+    uint64_t start;
+
+    snprintf(extra, sizeof(extra), "\"keys\": %u, \"latency_us\": %lu",
+            conf->keys, conf->latency);
+
+    errors = 0;
+    for (i = 0; i < conf->ops; i++) {
+        snprintf(key, sizeof(key), "key%lu", i % conf->keys);
+
+        start = bench_now_ns();
+        err = xs_write_k(xs, "value", BENCH_PATH, key);
+        samples[i] = bench_now_ns() - start;
+
+        if (err) {
+            errors++;
+        }
+    }
+    bench_report("xs_write_k", samples, conf->ops, errors, extra);
+
+    errors = 0;
+    for (i = 0; i < conf->ops; i++) {
+        snprintf(key, sizeof(key), "key%lu", i % conf->keys);
+
+        start = bench_now_ns();
+        value = xs_read_k(xs, BENCH_PATH, key);
+        samples[i] = bench_now_ns() - start;
+
+        if (value == NULL) {
+            errors++;
+        }
+        free(value);
+    }
+    bench_report("xs_read_k", samples, conf->ops, errors, extra);
+}
+
+
+int main(int argc, char** argv)
+{
+    int err;
+    pid_t xsd;
+    uint64_t* samples;
+    struct xs_handle* xs;
+    struct bench_conf conf;
+
+
+    /* Parse arguments */
+    init_bench_conf(&conf);
+
+    err = parse_args(argc, argv, &conf);
+    if (err || conf.help) {
+        print_usage(argv[0]);
+        return err ? 1 : 0;
+    }
+
+
+    /* setup xenstore */
+    xsd = bench_start_xenstored(conf.latency);
+    if (xsd < 0) {
+        fprintf(stderr, "Cannot start fake xenstored.\n");
+        return 1;
+    }
+
+    xs = xs_open_k();
+    if (xs == NULL) {
+        fprintf(stderr, "Cannot connect to xenstore.\n");
+        bench_stop_xenstored(xsd);
+        return 1;
+    }
+
+    samples = calloc(conf.ops, sizeof(uint64_t));
+    if (samples == NULL) {
+        xs_close(xs);
+        bench_stop_xenstored(xsd);
+        return 1;
+    }
+
+
+    /* run */
+    run(xs, &conf, samples);
+
+    xs_rm(xs, XBT_NULL, BENCH_PATH);
+    xs_close(xs);
+    free(samples);
+
+    bench_stop_xenstored(xsd);
+
+    return 0;
+}
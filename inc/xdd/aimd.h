@@ -0,0 +1,87 @@
+/*
+ * xendevd
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *
+ *
+ * Copyright (c) 2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef __XDD__AIMD__HH__
+#define __XDD__AIMD__HH__
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+
+
+/*
+ * AIMD concurrency control.
+ *
+ * Limits the number of operations in flight against a shared resource
+ * (xenstored, the RTNL lock) so that xendevd does not starve the toolstack
+ * during mass starts. Every completed operation reports its latency; while
+ * the smoothed latency stays below the target the limit grows by one per
+ * window of operations, above it the limit is halved.
+ *
+ * Controllers are installed per resource. The lib/xdd primitives call
+ * aimd_enter()/aimd_exit() around their operations, which does nothing for
+ * resources without a controller.
+ */
+enum aimd_resource {
+    AIMD_XENSTORE ,
+    AIMD_RTNL     ,
+    AIMD_NR       ,
+};
+
+struct aimd;
+
+struct aimd_stats {
+    double limit;
+    unsigned int inflight;
+    unsigned int target_us;
+    double latency_us;
+    uint64_t ops;
+    uint64_t waits;
+    uint64_t decreases;
+};
+
+struct aimd* aimd_new(unsigned int target_us, unsigned int min, unsigned int max);
+void aimd_free(struct aimd* c);
+void aimd_stats(struct aimd* c, struct aimd_stats* st);
+
+void aimd_install(enum aimd_resource r, struct aimd* c);
+uint64_t aimd_enter(enum aimd_resource r);
+void aimd_exit(enum aimd_resource r, uint64_t start);
+
+/* Writes the state of all installed controllers, one line each */
+void aimd_dump(FILE* f);
+
+#endif /* __XDD__AIMD__HH__ */
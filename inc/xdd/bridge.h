@@ -38,5 +38,6 @@
 
 int bridge_add_if(const char* bridge, const char* dev);
 int bridge_rem_if(const char* bridge, const char* dev);
+int bridge_has_if(const char* bridge, const char* dev);
 
 #endif /* __XDD__BRIDGE__HH__ */
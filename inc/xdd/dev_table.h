@@ -0,0 +1,86 @@
+/*
+ * xendevd
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *
+ *
+ * Copyright (c) 2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef __XDD__DEV_TABLE__HH__
+#define __XDD__DEV_TABLE__HH__
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+
+
+enum dev_type {
+    DEV_VIF ,
+    DEV_VBD ,
+};
+
+enum dev_state {
+    DEV_STATE_NONE    ,
+    DEV_STATE_ONLINE  ,
+    DEV_STATE_OFFLINE ,
+    DEV_STATE_FAILED  ,
+};
+
+/*
+ * Table of the devices xendevd handles, keyed by type, domid and devid.
+ *
+ * Handlers announce the state they are about to bring a device to with
+ * dev_table_want(), which tells them whether the device is already there
+ * (so duplicate or replayed events can be skipped), and record the outcome
+ * with dev_table_done(). Thread-safe.
+ *
+ * instance identifies what backs the device on the host, e.g. a vif's
+ * ifindex (0 if nothing does): a device that was recreated behind the
+ * table's back is not taken for online.
+ */
+struct dev_table;
+
+struct dev_table* dev_table_new(void);
+void dev_table_free(struct dev_table* tab);
+
+/* Returns 1 if the device already is in state with the same attachment and instance */
+int dev_table_want(struct dev_table* tab, enum dev_type type, unsigned int domid, unsigned int devid,
+        enum dev_state state, const char* attach, unsigned int instance);
+void dev_table_done(struct dev_table* tab, enum dev_type type, unsigned int domid, unsigned int devid,
+        enum dev_state state, const char* attach, unsigned int instance, int err);
+
+enum dev_state dev_table_desired(struct dev_table* tab, enum dev_type type, unsigned int domid, unsigned int devid);
+
+void dev_table_dump(struct dev_table* tab, FILE* f);
+
+/* Parses "vif-<domid>-<devid>" style names */
+int dev_parse_sysname(const char* sysname, unsigned int* domid, unsigned int* devid);
+
+#endif /* __XDD__DEV_TABLE__HH__ */
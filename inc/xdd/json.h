@@ -0,0 +1,105 @@
+/*
+ * xendevd
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *
+ *
+ * Copyright (c) 2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef __XDD__JSON__HH__
+#define __XDD__JSON__HH__
+
+#define _GNU_SOURCE
+
+#include <stddef.h>
+
+
+/*
+ * Small JSON reader and writer, enough for JSON-RPC.
+ *
+ * Parsed values form a tree: array elements and object members are
+ * linked through next starting at child, members carry their name in key.
+ */
+enum json_type {
+    JSON_NULL   ,
+    JSON_FALSE  ,
+    JSON_TRUE   ,
+    JSON_NUMBER ,
+    JSON_STRING ,
+    JSON_ARRAY  ,
+    JSON_OBJECT ,
+};
+
+struct json {
+    enum json_type type;
+    char* key;
+
+    double number;
+    char* string;
+
+    struct json* child;
+    struct json* next;
+};
+
+/*
+ * Parses the first value in buf and sets *used to the bytes it took.
+ * Returns NULL with errno EAGAIN if buf holds only part of a value and
+ * EINVAL if it is not JSON.
+ */
+struct json* json_parse(const char* buf, size_t len, size_t* used);
+void json_free(struct json* v);
+
+/* NULL if absent or of another type */
+struct json* json_get(const struct json* obj, const char* key);
+struct json* json_index(const struct json* arr, unsigned int i);
+unsigned int json_length(const struct json* arr);
+const char* json_string(const struct json* v);
+
+
+/* Growing output buffer, err is set on allocation failure */
+struct json_buf {
+    char* data;
+    size_t len;
+    size_t size;
+    int err;
+};
+
+void json_buf_init(struct json_buf* b);
+void json_buf_free(struct json_buf* b);
+
+void json_buf_printf(struct json_buf* b, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+/* Appends s as a quoted JSON string */
+void json_buf_string(struct json_buf* b, const char* s);
+
+/* Appends a parsed value, e.g. to echo it back */
+void json_buf_value(struct json_buf* b, const struct json* v);
+
+#endif /* __XDD__JSON__HH__ */
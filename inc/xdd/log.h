@@ -0,0 +1,81 @@
+/*
+ * xendevd
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *
+ *
+ * Copyright (c) 2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef __XDD__LOG__HH__
+#define __XDD__LOG__HH__
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <syslog.h>
+
+
+/*
+ * Asynchronous structured logging.
+ *
+ * log_msg() formats the record in the calling thread and pushes it into a
+ * lock-free ring; it never blocks and makes no system calls. A background
+ * thread drains the ring to the journal (native protocol, with the device,
+ * backend path and errno as fields) or to a file. Records are dropped,
+ * and counted, when the ring or the journal's socket is full or above the
+ * configured rate.
+ *
+ * Priorities are the syslog ones (LOG_ERR ... LOG_DEBUG). Before
+ * log_open() or without a target every record is discarded. log_close()
+ * flushes the ring and must not race with log_msg().
+ */
+#define LOG_TARGET_JOURNAL  "journal"
+#define LOG_TARGET_STDERR   "-"
+
+struct log_stats {
+    uint64_t written;
+    uint64_t dropped_full;
+    uint64_t dropped_rate;
+};
+
+/* target is LOG_TARGET_JOURNAL, LOG_TARGET_STDERR or a file to append to */
+int log_open(const char* target, int level, unsigned int rate);
+void log_close(void);
+
+void log_msg(int prio, const char* device, const char* xb_path, int err,
+        const char* fmt, ...) __attribute__((format(printf, 5, 6)));
+
+int log_level_parse(const char* name);
+
+void log_stats(struct log_stats* st);
+void log_dump(FILE* f);
+
+#endif /* __XDD__LOG__HH__ */
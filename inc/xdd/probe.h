@@ -0,0 +1,85 @@
+/*
+ * xendevd
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *
+ *
+ * Copyright (c) 2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef __XDD__PROBE__HH__
+#define __XDD__PROBE__HH__
+
+/*
+ * USDT probes, provider "xendevd".
+ *
+ * Built with sys/sdt.h unless the tree is configured with usdt=n. A probe
+ * site is a single nop until a tracer (bpftrace, perf, systemtap) attaches
+ * to it, e.g.
+ *
+ *   bpftrace -e 'usdt:app/xendevd:xendevd:bridge_add_if { printf("%s %s %d\n", str(arg0), str(arg1), arg2); }'
+ *
+ * Probes and their arguments:
+ *
+ *   event_receive       action, sysname, XENBUS_PATH
+ *   vif_hotplug_entry   sysname, XENBUS_PATH, action
+ *   vif_hotplug_return  sysname, XENBUS_PATH, errno
+ *   vbd_hotplug_entry   sysname, XENBUS_PATH, action
+ *   vbd_hotplug_return  sysname, XENBUS_PATH, errno
+ *   xs_read             path, errno
+ *   xs_write            path, value, errno
+ *   xs_rm_keys          count, errno
+ *   bridge_add_if       bridge, dev, errno
+ *   bridge_rem_if       bridge, dev, errno
+ *   iface_set_up        dev, errno
+ *   iface_set_down      dev, errno
+ *   ovs_transact        operations, errno
+ *   ovs_add_port        bridge, dev, errno
+ *   ovs_del_port        bridge, dev, errno
+ *   vif_route_add       dev, address, errno
+ *   vif_route_del       dev, address, errno
+ *   vif_release         dev, errno
+ *   domain_teardown     domid, events
+ */
+
+#ifdef XDD_USDT
+
+#include <sys/sdt.h>
+
+#define XDD_PROBE2(name, a, b)          DTRACE_PROBE2(xendevd, name, a, b)
+#define XDD_PROBE3(name, a, b, c)       DTRACE_PROBE3(xendevd, name, a, b, c)
+
+#else
+
+#define XDD_PROBE2(name, a, b)          do { (void) (a); (void) (b); } while (0)
+#define XDD_PROBE3(name, a, b, c)       do { (void) (a); (void) (b); (void) (c); } while (0)
+
+#endif
+
+#endif /* __XDD__PROBE__HH__ */
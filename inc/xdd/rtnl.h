@@ -0,0 +1,75 @@
+/*
+ * xendevd
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *
+ *
+ * Copyright (c) 2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef __XDD__RTNL__HH__
+#define __XDD__RTNL__HH__
+
+#define _GNU_SOURCE
+
+#include <stddef.h>
+
+
+/*
+ * Minimal rtnetlink client. Requests are sent synchronously and return 0
+ * or the errno reported by the kernel.
+ */
+struct rtnl;
+
+struct rtnl* rtnl_open(void);
+void rtnl_close(struct rtnl* nl);
+
+/* Creates a link of the given kind ("bridge", "dummy", "veth" with peer) */
+int rtnl_link_add(struct rtnl* nl, const char* name, const char* kind, const char* peer);
+int rtnl_link_del(struct rtnl* nl, const char* name);
+
+/*
+ * Takes each device down and out of its bridge. The requests go out in
+ * one batch, errs[i] receives the outcome for devs[i]. Returns 0 unless
+ * talking to the kernel failed altogether.
+ */
+int rtnl_link_release(struct rtnl* nl, const char** devs, unsigned int n, int* errs);
+
+/* Sets net.ipv4.conf.<dev>.proxy_arp */
+int rtnl_link_proxy_arp(struct rtnl* nl, const char* dev, int on);
+
+/* Host route (/32 or /128) to an IPv4 or IPv6 address through dev */
+int rtnl_route_add(struct rtnl* nl, const char* dev, const char* addr);
+int rtnl_route_del(struct rtnl* nl, const char* dev, const char* addr);
+
+/* Proxy neighbour entry, dev answers solicitations for addr (proxy NDP) */
+int rtnl_neigh_proxy_add(struct rtnl* nl, const char* dev, const char* addr);
+int rtnl_neigh_proxy_del(struct rtnl* nl, const char* dev, const char* addr);
+
+#endif /* __XDD__RTNL__HH__ */
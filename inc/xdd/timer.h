@@ -0,0 +1,68 @@
+/*
+ * xendevd
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *
+ *
+ * Copyright (c) 2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef __XDD__TIMER__HH__
+#define __XDD__TIMER__HH__
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+
+
+/*
+ * One-shot timers for an event loop.
+ *
+ * Timers may be added from any thread; the loop polls timer_queue_fileno(),
+ * which becomes readable when a timer was added, uses timer_queue_timeout()
+ * as its poll timeout and calls timer_queue_run() afterwards. Callbacks run
+ * in the thread calling timer_queue_run().
+ */
+struct timer_queue;
+
+typedef void (*timer_cb)(void* arg);
+
+struct timer_queue* timer_queue_new(void);
+void timer_queue_free(struct timer_queue* tq);
+
+int timer_add(struct timer_queue* tq, unsigned int delay_ms, timer_cb cb, void* arg);
+
+int timer_queue_fileno(struct timer_queue* tq);
+int timer_queue_timeout(struct timer_queue* tq);
+void timer_queue_run(struct timer_queue* tq);
+unsigned int timer_queue_pending(struct timer_queue* tq);
+
+uint64_t timer_now_ms(void);
+
+#endif /* __XDD__TIMER__HH__ */
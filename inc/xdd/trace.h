@@ -0,0 +1,75 @@
+/*
+ * xendevd
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *
+ *
+ * Copyright (c) 2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef __XDD__TRACE__HH__
+#define __XDD__TRACE__HH__
+
+#define _GNU_SOURCE
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/*
+ * Append-only binary trace of uevents.
+ *
+ * The file starts with TRACE_MAGIC and a 32 bit version. Each record is a
+ * 32 bit payload length, a 64 bit CLOCK_REALTIME timestamp in ns and the
+ * payload, a uevent in the kernel netlink format ("action@devpath" then
+ * NUL separated KEY=value properties). Integers are little endian. A
+ * record torn by a crash ends the trace.
+ */
+#define TRACE_MAGIC         "XDDTRACE"
+#define TRACE_VERSION       1
+#define TRACE_MAX_RECORD    65536
+
+struct trace;
+
+/* Opens a trace for appending, creating it if needed */
+struct trace* trace_open_append(const char* path);
+struct trace* trace_open_read(const char* path);
+void trace_close(struct trace* t);
+
+int trace_append(struct trace* t, uint64_t ts, const char* buf, size_t len);
+
+/*
+ * Reads the next record. The payload stays valid until the next call.
+ * Returns 0, ENODATA at the end of the trace or an errno.
+ */
+int trace_next(struct trace* t, uint64_t* ts, const char** buf, size_t* len);
+
+uint64_t trace_now_ns(void);
+
+#endif /* __XDD__TRACE__HH__ */
@@ -0,0 +1,76 @@
+/*
+ * xendevd
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *
+ *
+ * Copyright (c) 2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef __XDD__URING__HH__
+#define __XDD__URING__HH__
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+
+/*
+ * Minimal io_uring wrapper on top of the raw system calls, enough to
+ * submit a batch of requests and collect their completions.
+ *
+ * uring_open() fails with ENOSYS when the kernel lacks io_uring (or the
+ * STATX/OPENAT/READ operations, added in 5.6) so callers can fall back to
+ * synchronous calls.
+ */
+struct uring;
+
+struct uring* uring_open(unsigned int entries);
+void uring_close(struct uring* ring);
+
+/* Returns a zeroed submission entry, NULL if the ring is full */
+struct io_uring_sqe* uring_get_sqe(struct uring* ring);
+
+/* Submits queued entries and waits for at least wait_nr completions */
+int uring_submit(struct uring* ring, unsigned int wait_nr);
+
+/* Waits for a completion without submitting anything */
+int uring_wait(struct uring* ring);
+
+/*
+ * Entries taken by the kernel whose completions have not been popped yet.
+ * Their buffers must stay valid until they are.
+ */
+unsigned int uring_inflight(struct uring* ring);
+
+/* Pops one completion, returns EAGAIN if there is none */
+int uring_next_cqe(struct uring* ring, uint64_t* user_data, int* res);
+
+#endif /* __XDD__URING__HH__ */
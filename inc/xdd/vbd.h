@@ -38,10 +38,15 @@
 
 #define _GNU_SOURCE
 
+#include <xdd/blk.h>
+
 #include <stddef.h>
 #include <xenstore.h>
 
 
 int vbd_phy_hotplug_online(struct xs_handle* xs, const char* xb_path, const char* device);
 
+/* Writes the outcome of a blk_check to the backend, returns its error */
+int vbd_phy_hotplug_report(struct xs_handle* xs, const char* xb_path, const struct blk_check* check);
+
 #endif /* __XDD_VBD_HH__ */
@@ -42,7 +42,24 @@
 #include <xenstore.h>
 
 
+/*
+ * vif_hotplug_online is vif_hotplug_attach followed by vif_hotplug_report,
+ * attaching through the backend mapped to the bridge, see vif_backend.h.
+ * xs and xb_path are used for the vif's ids, if the backend wants them.
+ */
+int vif_hotplug_attach(struct xs_handle* xs, const char* xb_path, const char* bridge, const char* vif);
+void vif_hotplug_report(struct xs_handle* xs, const char* xb_path, int err);
+
+/* Whether an attach error may go away by itself, e.g. the uevent beat registration */
+int vif_hotplug_transient(int err);
+
 int vif_hotplug_online(struct xs_handle* xs, const char* xb_path, const char* bridge, const char* vif);
 int vif_hotplug_offline(struct xs_handle* xs, const char* xb_path, const char* bridge, const char* vif);
 
+/*
+ * vif_hotplug_offline for many vifs on Linux bridges at once, in a single
+ * rtnetlink batch. Vifs already gone count as released.
+ */
+void vif_hotplug_release(const char** vifs, unsigned int n, int* errs);
+
 #endif /* __XDD_VIF_HH__ */
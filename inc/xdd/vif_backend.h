@@ -0,0 +1,79 @@
+/*
+ * xendevd
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *
+ *
+ * Copyright (c) 2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef __XDD__VIF_BACKEND__HH__
+#define __XDD__VIF_BACKEND__HH__
+
+#define _GNU_SOURCE
+
+
+/*
+ * What identifies a vif to a switch keeping track of its ports, e.g. OVS
+ * external_ids. Members are NULL when unknown.
+ */
+struct vif_ids {
+    char* mac;
+    char* vm_id;
+    char* iface_id;
+};
+
+/*
+ * How a vif is plugged into a bridge. Callbacks return 0 or an errno and
+ * may be called from several workers at once. ids may be NULL, backends
+ * setting needs_ids get them when available.
+ */
+struct vif_backend {
+    const char* name;
+    int needs_ids;
+
+    int (*attach)(struct vif_backend* be, const char* bridge, const char* vif, const struct vif_ids* ids);
+    int (*detach)(struct vif_backend* be, const char* bridge, const char* vif);
+    int (*set_up)(struct vif_backend* be, const char* vif);
+    int (*set_down)(struct vif_backend* be, const char* vif);
+};
+
+/* Linux bridge, the default */
+extern struct vif_backend vif_backend_bridge;
+
+#define VIF_BACKEND_MAX 16
+
+/*
+ * Uses be for bridges whose name matches the shell pattern, first match
+ * wins. Not thread safe, mappings are set up before handling events.
+ */
+int vif_backend_map(const char* pattern, struct vif_backend* be);
+struct vif_backend* vif_backend_for(const char* bridge);
+
+#endif /* __XDD__VIF_BACKEND__HH__ */
@@ -0,0 +1,75 @@
+/*
+ * xendevd
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *
+ *
+ * Copyright (c) 2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef __XDD__XS_ASYNC__HH__
+#define __XDD__XS_ASYNC__HH__
+
+#define _GNU_SOURCE
+
+#include <stddef.h>
+#include <xenstore.h>
+
+
+/*
+ * Asynchronous xenstore client.
+ *
+ * Talks the xenstored wire protocol directly over its unix socket, so many
+ * requests can be in flight at once. Replies are matched to requests by
+ * req_id and completions are delivered from xs_async_process(), which is
+ * meant to be called from the event loop when xs_async_fileno() is ready
+ * for the events returned by xs_async_events().
+ *
+ * Completion callbacks get err == 0 and the reply payload on success, or
+ * the errno reported by xenstored (value == NULL) on failure.
+ */
+struct xs_async;
+
+typedef void (*xs_async_cb)(void* arg, int err, const char* value, unsigned int len);
+
+struct xs_async* xs_async_open(void);
+void xs_async_close(struct xs_async* xa);
+
+int xs_async_fileno(struct xs_async* xa);
+short xs_async_events(struct xs_async* xa);
+int xs_async_process(struct xs_async* xa);
+unsigned int xs_async_pending(struct xs_async* xa);
+
+int xs_async_read(struct xs_async* xa, const char* path, xs_async_cb cb, void* arg);
+int xs_async_write(struct xs_async* xa, const char* path, const char* value, xs_async_cb cb, void* arg);
+
+int xs_read_k_async(struct xs_async* xa, const char* base_path, const char* key, xs_async_cb cb, void* arg);
+int xs_write_k_async(struct xs_async* xa, const char* value, const char* base_path, const char* key, xs_async_cb cb, void* arg);
+
+#endif /* __XDD__XS_ASYNC__HH__ */
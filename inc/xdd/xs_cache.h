@@ -0,0 +1,90 @@
+/*
+ * xendevd
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *
+ *
+ * Copyright (c) 2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef __XDD__XS_CACHE__HH__
+#define __XDD__XS_CACHE__HH__
+
+#define _GNU_SOURCE
+
+#include <stddef.h>
+#include <xenstore.h>
+
+
+/*
+ * Cache of backend xenstore keys, invalidated by xenstore watches.
+ *
+ * A single watch on the root of the cached paths (e.g. "backend") is
+ * registered on creation. A watch event marks the affected keys stale and
+ * they are re-read on the next lookup. If the re-read fails (e.g. the
+ * backend node has already been removed) the last known value is returned
+ * instead. Paths outside the root, or everything if the watch could not be
+ * registered, are read through without caching.
+ *
+ * The cache takes over the handle it is created with, which carries the
+ * watch. xs_cache_check() makes sure both are still there: if xenstored
+ * went away (e.g. restarted) the cache is flushed and the handle reopened
+ * and watching again, reconnected is then set. Returns an errno code while
+ * that fails; call it periodically from the thread polling the watch fd.
+ */
+struct xs_cache;
+
+struct xs_cache* xs_cache_new(struct xs_handle* xs, const char* root);
+void xs_cache_free(struct xs_cache* cache);
+
+/*
+ * Returns a malloc'ed copy of the value, as xs_read_k does. Misses are read
+ * through xs, so each thread can use its own handle. Thread-safe.
+ */
+char* xs_cache_read_k(struct xs_cache* cache, struct xs_handle* xs, const char* base_path, const char* key);
+void xs_cache_forget(struct xs_cache* cache, const char* base_path);
+
+/*
+ * For filling the cache from elsewhere, e.g. asynchronous prefetch.
+ * xs_cache_want() tells whether key needs to be fetched and returns the
+ * key's generation in gen; call it before issuing the read and pass gen to
+ * xs_cache_store(), which drops the value if the key was invalidated in
+ * the meantime.
+ */
+int xs_cache_want(struct xs_cache* cache, const char* base_path, const char* key, unsigned int* gen);
+void xs_cache_store(struct xs_cache* cache, const char* base_path, const char* key,
+        const char* value, unsigned int gen);
+
+int xs_cache_check(struct xs_cache* cache, int* reconnected);
+
+/* Watch fd to poll on (-1 while disconnected), and handler to call when it becomes readable. */
+int xs_cache_fileno(struct xs_cache* cache);
+void xs_cache_handle_watch(struct xs_cache* cache);
+
+#endif /* __XDD__XS_CACHE__HH__ */
@@ -42,7 +42,38 @@
 #include <xenstore.h>
 
 
+/* Like xs_open(0), but sticks to the socket if XENSTORED_PATH is set. */
+struct xs_handle* xs_open_k(void);
+
+/* A round trip on xs, false if the connection broke (e.g. xenstored restarted) */
+int xs_alive_k(struct xs_handle* xs);
+
 char* xs_read_k(struct xs_handle* xs, const char* base_path, const char* key);
 int xs_write_k(struct xs_handle* xs, const char* value, const char* base_path, const char* key);
 
+/*
+ * Removes every key (a NULL terminated list) under each of n base paths in
+ * one transaction. Keys that don't exist are skipped.
+ */
+int xs_rm_keys_k(struct xs_handle* xs, char** base_paths, unsigned int n, const char** keys);
+
+
+/*
+ * Pool of xenstore connections with one handle per thread, so threads don't
+ * serialise behind a shared handle. Handles are opened on first use by a
+ * thread and transparently reopened after xs_read_k/xs_write_k saw the
+ * connection break, e.g. because xenstored restarted. At most size threads
+ * get a handle, further callers get NULL with errno set to EMFILE.
+ */
+struct xs_pool;
+
+struct xs_pool* xs_pool_new(unsigned int size);
+void xs_pool_free(struct xs_pool* pool);
+
+struct xs_handle* xs_pool_get(struct xs_pool* pool);
+
+/* xs_read_k/xs_write_k on the thread's handle, retried once on reconnect */
+char* xs_pool_read_k(struct xs_pool* pool, const char* base_path, const char* key);
+int xs_pool_write_k(struct xs_pool* pool, const char* value, const char* base_path, const char* key);
+
 #endif /* __XDD_XS_HELPER__HH__ */
@@ -0,0 +1,227 @@
+/*
+ * xendevd
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *
+ *
+ * Copyright (c) 2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <xdd/aimd.h>
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+
+/* weight of a new sample in the smoothed latency */
+#define AIMD_EWMA_WEIGHT    0.125
+
+struct aimd {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    double limit;
+    unsigned int min;
+    unsigned int max;
+    unsigned int inflight;
+
+    unsigned int target_us;
+    double latency_us;
+
+    /* operations completed since the last decrease */
+    uint64_t window;
+
+    uint64_t ops;
+    uint64_t waits;
+    uint64_t decreases;
+};
+
+static struct aimd* controllers[AIMD_NR];
+
+static const char* resource_names[] = {
+    [AIMD_XENSTORE] = "xenstore",
+    [AIMD_RTNL]     = "rtnl",
+};
+
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+struct aimd* aimd_new(unsigned int target_us, unsigned int min, unsigned int max)
+{
+    struct aimd* c;
+
+    c = calloc(1, sizeof(struct aimd));
+    if (c == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_init(&c->lock, NULL);
+    pthread_cond_init(&c->cond, NULL);
+
+    c->min = min ? min : 1;
+    c->max = max > c->min ? max : c->min;
+    c->limit = c->max;
+    c->target_us = target_us;
+
+    return c;
+}
+
+void aimd_free(struct aimd* c)
+{
+    pthread_mutex_destroy(&c->lock);
+    pthread_cond_destroy(&c->cond);
+    free(c);
+}
+
+void aimd_stats(struct aimd* c, struct aimd_stats* st)
+{
+    pthread_mutex_lock(&c->lock);
+
+    st->limit = c->limit;
+    st->inflight = c->inflight;
+    st->target_us = c->target_us;
+    st->latency_us = c->latency_us;
+    st->ops = c->ops;
+    st->waits = c->waits;
+    st->decreases = c->decreases;
+
+    pthread_mutex_unlock(&c->lock);
+}
+
+void aimd_install(enum aimd_resource r, struct aimd* c)
+{
+    controllers[r] = c;
+}
+
+uint64_t aimd_enter(enum aimd_resource r)
+{
+    int saved_errno;
+    struct aimd* c = controllers[r];
+
+    if (c == NULL) {
+        return 0;
+    }
+
+    /* callers look at errno around the operation */
+    saved_errno = errno;
+
+    pthread_mutex_lock(&c->lock);
+
+    if (c->inflight >= (unsigned int) c->limit) {
+        c->waits++;
+        do {
+            pthread_cond_wait(&c->cond, &c->lock);
+        } while (c->inflight >= (unsigned int) c->limit);
+    }
+    c->inflight++;
+
+    pthread_mutex_unlock(&c->lock);
+
+    errno = saved_errno;
+
+    return now_us();
+}
+
+void aimd_exit(enum aimd_resource r, uint64_t start)
+{
+    int saved_errno;
+    uint64_t latency;
+    struct aimd* c = controllers[r];
+
+    if (c == NULL) {
+        return;
+    }
+
+    saved_errno = errno;
+    latency = now_us() - start;
+
+    pthread_mutex_lock(&c->lock);
+
+    c->inflight--;
+    c->ops++;
+    c->window++;
+
+    if (c->ops == 1) {
+        c->latency_us = latency;
+    } else {
+        c->latency_us += AIMD_EWMA_WEIGHT * (latency - c->latency_us);
+    }
+
+    if (c->latency_us > c->target_us) {
+        /* at most one decrease per window, operations in flight saw the old limit */
+        if (c->window >= c->limit) {
+            c->limit /= 2;
+            if (c->limit < c->min) {
+                c->limit = c->min;
+            }
+            c->window = 0;
+            c->decreases++;
+        }
+    } else {
+        c->limit += 1 / c->limit;
+        if (c->limit > c->max) {
+            c->limit = c->max;
+        }
+    }
+
+    pthread_cond_broadcast(&c->cond);
+    pthread_mutex_unlock(&c->lock);
+
+    errno = saved_errno;
+}
+
+void aimd_dump(FILE* f)
+{
+    int r;
+    struct aimd_stats st;
+
+    for (r = 0; r < AIMD_NR; r++) {
+        if (controllers[r] == NULL) {
+            continue;
+        }
+
+        aimd_stats(controllers[r], &st);
+
+        fprintf(f, "aimd %s limit=%.2f inflight=%u target_us=%u latency_us=%.0f ops=%llu waits=%llu decreases=%llu\n",
+                resource_names[r], st.limit, st.inflight, st.target_us, st.latency_us,
+                (unsigned long long) st.ops, (unsigned long long) st.waits,
+                (unsigned long long) st.decreases);
+    }
+}
@@ -0,0 +1,319 @@
+/*
+ * xendevd
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *
+ *
+ * Copyright (c) 2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <xdd/blk.h>
+#include <xdd/uring.h>
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+
+/* Requests in flight per batch */
+#define BLK_BATCH   256
+
+struct blk_op {
+    struct blk_check* check;
+    struct statx stx;
+    char sysfs_path[64];
+    int parent;
+    int fd;
+    char buf[32];
+};
+
+
+/*
+ * Partitions have no queue of their own, theirs is the disk's: the sysfs
+ * link of a partition points into its disk's directory, so it is found
+ * through "..".
+ */
+static void sysfs_path(struct blk_op* op)
+{
+    snprintf(op->sysfs_path, sizeof(op->sysfs_path), "/sys/dev/block/%u:%u/%squeue/logical_block_size",
+            major(op->check->rdev), minor(op->check->rdev), op->parent ? "../" : "");
+}
+
+static void parse_block_size(struct blk_op* op, ssize_t len)
+{
+    if (len <= 0) {
+        op->check->err = ENODEV;
+        return;
+    }
+
+    op->buf[len < sizeof(op->buf) ? len : sizeof(op->buf) - 1] = '\0';
+    op->check->block_size = strtoul(op->buf, NULL, 10);
+}
+
+static void check_sync(struct blk_op* op)
+{
+    struct stat st;
+    struct blk_check* c = op->check;
+
+    if (stat(c->path, &st)) {
+        c->err = errno;
+        return;
+    }
+
+    if (!S_ISBLK(st.st_mode)) {
+        c->err = ENOTBLK;
+        return;
+    }
+
+    c->rdev = st.st_rdev;
+
+    sysfs_path(op);
+    op->fd = open(op->sysfs_path, O_RDONLY | O_CLOEXEC);
+    if (op->fd < 0 && errno == ENOENT) {
+        op->parent = 1;
+        sysfs_path(op);
+        op->fd = open(op->sysfs_path, O_RDONLY | O_CLOEXEC);
+    }
+    if (op->fd < 0) {
+        c->err = ENODEV;
+        return;
+    }
+
+    parse_block_size(op, read(op->fd, op->buf, sizeof(op->buf) - 1));
+    close(op->fd);
+}
+
+#ifdef XDD_URING
+enum blk_stage {
+    BLK_STATX,
+    BLK_OPEN,
+    BLK_READ,
+};
+
+static void complete(struct blk_op* op, enum blk_stage stage, int res)
+{
+    switch (stage) {
+        case BLK_STATX:
+            if (res < 0) {
+                op->check->err = -res;
+            } else if (!S_ISBLK(op->stx.stx_mode)) {
+                op->check->err = ENOTBLK;
+            } else {
+                op->check->rdev = makedev(op->stx.stx_rdev_major, op->stx.stx_rdev_minor);
+            }
+            break;
+        case BLK_OPEN:
+            if (res == -ENOENT && !op->parent) {
+                /* maybe a partition, try again with its disk's queue */
+                op->parent = 1;
+            } else if (res < 0) {
+                op->check->err = ENODEV;
+            } else {
+                op->fd = res;
+            }
+            break;
+        case BLK_READ:
+            parse_block_size(op, res);
+            close(op->fd);
+            op->fd = -1;
+            break;
+    }
+}
+
+/*
+ * Runs one stage for every op still without error and waits for all of
+ * them, returns non-zero if the ring could not be used. Requests the
+ * kernel already took are waited for even then, as they still write into
+ * ops; only if that wait fails are some left in flight.
+ */
+static int run_stage(struct uring* ring, struct blk_op* ops, unsigned int n, enum blk_stage stage)
+{
+    int err = 0;
+    int res;
+    uint64_t idx;
+    unsigned int i;
+    unsigned int queued = 0;
+    unsigned int reaped = 0;
+    struct blk_op* op;
+    struct io_uring_sqe* sqe;
+
+    for (i = 0; i < n; i++) {
+        op = &ops[i];
+        if (op->check->err || (stage == BLK_OPEN && op->fd >= 0)) {
+            continue;
+        }
+
+        sqe = uring_get_sqe(ring);
+        if (sqe == NULL) {
+            return ENOSPC;
+        }
+
+        switch (stage) {
+            case BLK_STATX:
+                sqe->opcode = IORING_OP_STATX;
+                sqe->fd = AT_FDCWD;
+                sqe->addr = (uint64_t) (uintptr_t) op->check->path;
+                sqe->len = STATX_TYPE | STATX_MODE;
+                sqe->off = (uint64_t) (uintptr_t) &op->stx;
+                break;
+            case BLK_OPEN:
+                sysfs_path(op);
+                sqe->opcode = IORING_OP_OPENAT;
+                sqe->fd = AT_FDCWD;
+                sqe->addr = (uint64_t) (uintptr_t) op->sysfs_path;
+                sqe->open_flags = O_RDONLY | O_CLOEXEC;
+                break;
+            case BLK_READ:
+                sqe->opcode = IORING_OP_READ;
+                sqe->fd = op->fd;
+                sqe->addr = (uint64_t) (uintptr_t) op->buf;
+                sqe->len = sizeof(op->buf) - 1;
+                break;
+        }
+        sqe->user_data = i;
+        queued++;
+    }
+
+    if (queued == 0) {
+        return 0;
+    }
+
+    err = uring_submit(ring, queued);
+
+    while (!err && reaped < queued) {
+        if (uring_next_cqe(ring, &idx, &res) == 0) {
+            complete(&ops[idx], stage, res);
+            reaped++;
+        } else {
+            err = uring_submit(ring, 1);
+        }
+    }
+
+    while (err && uring_inflight(ring)) {
+        if (uring_next_cqe(ring, &idx, &res) == 0) {
+            complete(&ops[idx], stage, res);
+        } else if (uring_wait(ring)) {
+            break;
+        }
+    }
+
+    return err;
+}
+
+/* Returns non-zero if the checks have to be done synchronously */
+static int check_uring(struct blk_check* checks, unsigned int n)
+{
+    int err = 0;
+    unsigned int i;
+    unsigned int len;
+    struct uring* ring;
+    struct blk_op* ops;
+
+    ops = calloc(n, sizeof(struct blk_op));
+    if (ops == NULL) {
+        return ENOMEM;
+    }
+
+    for (i = 0; i < n; i++) {
+        ops[i].check = &checks[i];
+        ops[i].fd = -1;
+    }
+
+    ring = uring_open(BLK_BATCH);
+    if (ring == NULL) {
+        err = errno;
+        free(ops);
+        return err;
+    }
+
+    for (i = 0; i < n && !err; i += BLK_BATCH) {
+        len = n - i < BLK_BATCH ? n - i : BLK_BATCH;
+        err = run_stage(ring, &ops[i], len, BLK_STATX);
+        err = err ? err : run_stage(ring, &ops[i], len, BLK_OPEN);
+        /* partitions, through their disk */
+        err = err ? err : run_stage(ring, &ops[i], len, BLK_OPEN);
+        err = err ? err : run_stage(ring, &ops[i], len, BLK_READ);
+    }
+
+    /* the kernel may still write into ops, better leak them */
+    if (uring_inflight(ring)) {
+        return err;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (ops[i].fd >= 0) {
+            close(ops[i].fd);
+        }
+    }
+
+    uring_close(ring);
+    free(ops);
+
+    return err;
+}
+#endif
+
+void blk_check_batch(struct blk_check* checks, unsigned int n)
+{
+    unsigned int i;
+    struct blk_op op;
+
+    for (i = 0; i < n; i++) {
+        checks[i].err = 0;
+        checks[i].rdev = 0;
+        checks[i].block_size = 0;
+    }
+
+#ifdef XDD_URING
+    /* a single device gains nothing from the ring */
+    if (n > 1 && check_uring(checks, n) == 0) {
+        return;
+    }
+
+    /* start over synchronously */
+    for (i = 0; i < n; i++) {
+        checks[i].err = 0;
+        checks[i].rdev = 0;
+        checks[i].block_size = 0;
+    }
+#endif
+
+    for (i = 0; i < n; i++) {
+        memset(&op, 0, sizeof(op));
+        op.check = &checks[i];
+        check_sync(&op);
+    }
+}
@@ -33,11 +33,14 @@
  *
  */
 
+#include <xdd/aimd.h>
 #include <xdd/bridge.h>
+#include <xdd/probe.h>
 
 #include <errno.h>
 #include <net/if.h>
 #include <netinet/in.h>
+#include <stdio.h>
 #include <string.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
@@ -66,7 +69,9 @@ static int bridge_if(int op, const char* bridge, const char* dev)
 
 	err = ioctl(sock_fd, op, &ifr);
     if (err < 0) {
-        return errno;
+        err = errno;
+        close(sock_fd);
+        return err;
     }
 
     err = close(sock_fd);
@@ -79,11 +84,37 @@ static int bridge_if(int op, const char* bridge, const char* dev)
 
 int bridge_add_if(const char* bridge, const char* dev)
 {
-    return bridge_if(SIOCBRADDIF, bridge, dev);
+    int err;
+    uint64_t start = aimd_enter(AIMD_RTNL);
+
+    err = bridge_if(SIOCBRADDIF, bridge, dev);
+
+    aimd_exit(AIMD_RTNL, start);
+
+    XDD_PROBE3(bridge_add_if, bridge, dev, err);
+
+    return err;
 }
 
 int bridge_rem_if(const char* bridge, const char* dev)
 {
-    return bridge_if(SIOCBRDELIF, bridge, dev);
+    int err;
+    uint64_t start = aimd_enter(AIMD_RTNL);
+
+    err = bridge_if(SIOCBRDELIF, bridge, dev);
+
+    aimd_exit(AIMD_RTNL, start);
+
+    XDD_PROBE3(bridge_rem_if, bridge, dev, err);
+
+    return err;
 }
 
+int bridge_has_if(const char* bridge, const char* dev)
+{
+    char path[64 + 2 * IFNAMSIZ];
+
+    snprintf(path, sizeof(path), "/sys/class/net/%s/brif/%s", bridge, dev);
+
+    return access(path, F_OK) == 0;
+}
@@ -0,0 +1,274 @@
+/*
+ * xendevd
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *
+ *
+ * Copyright (c) 2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <xdd/dev_table.h>
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+#define DEV_TABLE_BUCKETS       1024
+
+/* Offline devices are kept for a while to absorb duplicate offline events */
+#define DEV_TABLE_OFFLINE_TTL   60
+#define DEV_TABLE_PRUNE_EVERY   256
+
+struct dev {
+    enum dev_type type;
+    unsigned int domid;
+    unsigned int devid;
+
+    enum dev_state desired;
+    enum dev_state actual;
+    char* attach;
+    unsigned int instance;
+    int err;
+    time_t since;
+
+    struct dev* next;
+};
+
+struct dev_table {
+    pthread_mutex_t lock;
+    unsigned int inserts;
+    struct dev* buckets[DEV_TABLE_BUCKETS];
+};
+
+static const char* type_names[] = {
+    [DEV_VIF] = "vif",
+    [DEV_VBD] = "vbd",
+};
+
+static const char* state_names[] = {
+    [DEV_STATE_NONE]    = "none",
+    [DEV_STATE_ONLINE]  = "online",
+    [DEV_STATE_OFFLINE] = "offline",
+    [DEV_STATE_FAILED]  = "failed",
+};
+
+
+static struct dev** find_dev(struct dev_table* tab, enum dev_type type, unsigned int domid, unsigned int devid)
+{
+    struct dev** d;
+    unsigned int h = (domid * 31 + devid) * 2 + type;
+
+    d = &tab->buckets[h % DEV_TABLE_BUCKETS];
+    while (*d && ((*d)->type != type || (*d)->domid != domid || (*d)->devid != devid)) {
+        d = &(*d)->next;
+    }
+
+    return d;
+}
+
+static void prune(struct dev_table* tab, time_t now)
+{
+    int i;
+    struct dev* dead;
+    struct dev** d;
+
+    for (i = 0; i < DEV_TABLE_BUCKETS; i++) {
+        d = &tab->buckets[i];
+        while (*d) {
+            if ((*d)->actual == DEV_STATE_OFFLINE && (*d)->desired == DEV_STATE_OFFLINE &&
+                    now - (*d)->since > DEV_TABLE_OFFLINE_TTL) {
+                dead = *d;
+                *d = dead->next;
+                free(dead->attach);
+                free(dead);
+            } else {
+                d = &(*d)->next;
+            }
+        }
+    }
+}
+
+static int same_attach(const char* a, const char* b)
+{
+    if (a == NULL || b == NULL) {
+        return a == b;
+    }
+
+    return strcmp(a, b) == 0;
+}
+
+
+struct dev_table* dev_table_new(void)
+{
+    struct dev_table* tab;
+
+    tab = calloc(1, sizeof(struct dev_table));
+    if (tab == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_init(&tab->lock, NULL);
+
+    return tab;
+}
+
+void dev_table_free(struct dev_table* tab)
+{
+    int i;
+    struct dev* d;
+
+    for (i = 0; i < DEV_TABLE_BUCKETS; i++) {
+        while (tab->buckets[i]) {
+            d = tab->buckets[i];
+            tab->buckets[i] = d->next;
+            free(d->attach);
+            free(d);
+        }
+    }
+
+    pthread_mutex_destroy(&tab->lock);
+    free(tab);
+}
+
+int dev_table_want(struct dev_table* tab, enum dev_type type, unsigned int domid, unsigned int devid,
+        enum dev_state state, const char* attach, unsigned int instance)
+{
+    int done = 0;
+    struct dev** d;
+    time_t now = time(NULL);
+
+    pthread_mutex_lock(&tab->lock);
+
+    d = find_dev(tab, type, domid, devid);
+    if (*d == NULL) {
+        if (++tab->inserts % DEV_TABLE_PRUNE_EVERY == 0) {
+            prune(tab, now);
+            d = find_dev(tab, type, domid, devid);
+        }
+
+        *d = calloc(1, sizeof(struct dev));
+        if (*d == NULL) {
+            goto out;
+        }
+
+        (*d)->type = type;
+        (*d)->domid = domid;
+        (*d)->devid = devid;
+        (*d)->actual = DEV_STATE_NONE;
+        (*d)->since = now;
+    }
+
+    if ((*d)->actual == state && (state != DEV_STATE_ONLINE ||
+                (same_attach((*d)->attach, attach) && (*d)->instance == instance))) {
+        done = 1;
+    }
+
+    (*d)->desired = state;
+
+out:
+    pthread_mutex_unlock(&tab->lock);
+
+    return done;
+}
+
+void dev_table_done(struct dev_table* tab, enum dev_type type, unsigned int domid, unsigned int devid,
+        enum dev_state state, const char* attach, unsigned int instance, int err)
+{
+    struct dev* d;
+
+    pthread_mutex_lock(&tab->lock);
+
+    d = *find_dev(tab, type, domid, devid);
+    if (d) {
+        d->actual = state;
+        d->instance = instance;
+        d->err = err;
+        d->since = time(NULL);
+
+        if (attach && !same_attach(d->attach, attach)) {
+            free(d->attach);
+            d->attach = strdup(attach);
+        }
+    }
+
+    pthread_mutex_unlock(&tab->lock);
+}
+
+enum dev_state dev_table_desired(struct dev_table* tab, enum dev_type type, unsigned int domid, unsigned int devid)
+{
+    struct dev* d;
+    enum dev_state state = DEV_STATE_NONE;
+
+    pthread_mutex_lock(&tab->lock);
+
+    d = *find_dev(tab, type, domid, devid);
+    if (d) {
+        state = d->desired;
+    }
+
+    pthread_mutex_unlock(&tab->lock);
+
+    return state;
+}
+
+void dev_table_dump(struct dev_table* tab, FILE* f)
+{
+    int i;
+    struct dev* d;
+    time_t now = time(NULL);
+
+    pthread_mutex_lock(&tab->lock);
+
+    for (i = 0; i < DEV_TABLE_BUCKETS; i++) {
+        for (d = tab->buckets[i]; d; d = d->next) {
+            fprintf(f, "%s %u %u desired=%s actual=%s attach=%s error=%d age=%ld\n",
+                    type_names[d->type], d->domid, d->devid,
+                    state_names[d->desired], state_names[d->actual],
+                    d->attach ? d->attach : "-", d->err, (long) (now - d->since));
+        }
+    }
+
+    pthread_mutex_unlock(&tab->lock);
+}
+
+int dev_parse_sysname(const char* sysname, unsigned int* domid, unsigned int* devid)
+{
+    const char* ids = strchr(sysname, '-');
+
+    if (ids == NULL || sscanf(ids, "-%u-%u", domid, devid) != 2) {
+        return -1;
+    }
+
+    return 0;
+}
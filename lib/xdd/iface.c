@@ -33,7 +33,9 @@
  *
  */
 
+#include <xdd/aimd.h>
 #include <xdd/iface.h>
+#include <xdd/probe.h>
 
 #include <errno.h>
 #include <net/if.h>
@@ -60,7 +62,9 @@ static int iface_flag_set(int flag, const char* dev)
 
     err = ioctl(sock_fd, SIOCGIFFLAGS, &ifr);
     if (err < 0) {
-        return errno;
+        err = errno;
+        close(sock_fd);
+        return err;
     }
 
     if (flag < 0) {
@@ -72,7 +76,9 @@ static int iface_flag_set(int flag, const char* dev)
 
     err = ioctl(sock_fd, SIOCSIFFLAGS, &ifr);
     if (err < 0) {
-        return errno;
+        err = errno;
+        close(sock_fd);
+        return err;
     }
 
     err = close(sock_fd);
@@ -85,10 +91,28 @@ static int iface_flag_set(int flag, const char* dev)
 
 int iface_set_up(const char* dev)
 {
-    return iface_flag_set(IFF_UP, dev);
+    int err;
+    uint64_t start = aimd_enter(AIMD_RTNL);
+
+    err = iface_flag_set(IFF_UP, dev);
+
+    aimd_exit(AIMD_RTNL, start);
+
+    XDD_PROBE2(iface_set_up, dev, err);
+
+    return err;
 }
 
 int iface_set_down(const char* dev)
 {
-    return iface_flag_set(-IFF_UP, dev);
+    int err;
+    uint64_t start = aimd_enter(AIMD_RTNL);
+
+    err = iface_flag_set(-IFF_UP, dev);
+
+    aimd_exit(AIMD_RTNL, start);
+
+    XDD_PROBE2(iface_set_down, dev, err);
+
+    return err;
 }
@@ -0,0 +1,519 @@
+/*
+ * xendevd
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *
+ *
+ * Copyright (c) 2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <xdd/json.h>
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/* Nesting limit, so hostile input can't exhaust the stack */
+#define JSON_MAX_DEPTH  64
+
+struct parser {
+    const char* p;
+    const char* end;
+    int err;
+};
+
+
+static void skip_ws(struct parser* ps)
+{
+    while (ps->p < ps->end &&
+            (*ps->p == ' ' || *ps->p == '\t' || *ps->p == '\n' || *ps->p == '\r')) {
+        ps->p++;
+    }
+}
+
+static int need(struct parser* ps, size_t n)
+{
+    if (ps->p >= ps->end || (size_t) (ps->end - ps->p) < n) {
+        ps->err = EAGAIN;
+        return 0;
+    }
+
+    return 1;
+}
+
+static void put_utf8(char* out, size_t* len, unsigned int cp)
+{
+    if (cp < 0x80) {
+        out[(*len)++] = cp;
+    } else if (cp < 0x800) {
+        out[(*len)++] = 0xc0 | (cp >> 6);
+        out[(*len)++] = 0x80 | (cp & 0x3f);
+    } else {
+        out[(*len)++] = 0xe0 | (cp >> 12);
+        out[(*len)++] = 0x80 | ((cp >> 6) & 0x3f);
+        out[(*len)++] = 0x80 | (cp & 0x3f);
+    }
+}
+
+static char* parse_string(struct parser* ps)
+{
+    char* out;
+    size_t len = 0;
+    unsigned int cp;
+    const char* start;
+
+    /* the decoded string is never longer than its encoding */
+    start = ++ps->p;
+    while (ps->p < ps->end && *ps->p != '"') {
+        if (*ps->p == '\\' && ps->end - ps->p > 1) {
+            ps->p++;
+        }
+        ps->p++;
+    }
+    if (!need(ps, 1)) {
+        return NULL;
+    }
+
+    out = malloc(ps->p - start + 1);
+    if (out == NULL) {
+        ps->err = ENOMEM;
+        return NULL;
+    }
+
+    for (ps->p = start; *ps->p != '"'; ps->p++) {
+        if (*ps->p != '\\') {
+            out[len++] = *ps->p;
+            continue;
+        }
+
+        switch (*++ps->p) {
+            case 'b': out[len++] = '\b'; break;
+            case 'f': out[len++] = '\f'; break;
+            case 'n': out[len++] = '\n'; break;
+            case 'r': out[len++] = '\r'; break;
+            case 't': out[len++] = '\t'; break;
+            case 'u':
+                if (ps->end - ps->p < 5 || sscanf(ps->p + 1, "%4x", &cp) != 1) {
+                    free(out);
+                    ps->err = EINVAL;
+                    return NULL;
+                }
+                put_utf8(out, &len, cp);
+                ps->p += 4;
+                break;
+            default:
+                out[len++] = *ps->p;
+                break;
+        }
+    }
+    ps->p++;
+
+    out[len] = '\0';
+
+    return out;
+}
+
+static struct json* parse_value(struct parser* ps, int depth);
+
+static struct json* parse_container(struct parser* ps, struct json* v, int depth)
+{
+    char close = v->type == JSON_ARRAY ? ']' : '}';
+    char* key = NULL;
+    struct json* item;
+    struct json** link = &v->child;
+
+    ps->p++;
+
+    skip_ws(ps);
+    if (!need(ps, 1)) {
+        return NULL;
+    }
+    if (*ps->p == close) {
+        ps->p++;
+        return v;
+    }
+
+    while (1) {
+        if (v->type == JSON_OBJECT) {
+            skip_ws(ps);
+            if (!need(ps, 1)) {
+                return NULL;
+            }
+            if (*ps->p != '"') {
+                ps->err = EINVAL;
+                return NULL;
+            }
+
+            key = parse_string(ps);
+            if (key == NULL) {
+                return NULL;
+            }
+
+            skip_ws(ps);
+            if (!need(ps, 1) || *ps->p != ':') {
+                ps->err = ps->err ? ps->err : EINVAL;
+                free(key);
+                return NULL;
+            }
+            ps->p++;
+        }
+
+        item = parse_value(ps, depth + 1);
+        if (item == NULL) {
+            free(key);
+            return NULL;
+        }
+        item->key = key;
+        key = NULL;
+
+        *link = item;
+        link = &item->next;
+
+        skip_ws(ps);
+        if (!need(ps, 1)) {
+            return NULL;
+        }
+
+        if (*ps->p == close) {
+            ps->p++;
+            return v;
+        }
+        if (*ps->p != ',') {
+            ps->err = EINVAL;
+            return NULL;
+        }
+        ps->p++;
+    }
+}
+
+static struct json* parse_value(struct parser* ps, int depth)
+{
+    char* end;
+    struct json* v;
+
+    if (depth > JSON_MAX_DEPTH) {
+        ps->err = EINVAL;
+        return NULL;
+    }
+
+    skip_ws(ps);
+    if (!need(ps, 1)) {
+        return NULL;
+    }
+
+    v = calloc(1, sizeof(struct json));
+    if (v == NULL) {
+        ps->err = ENOMEM;
+        return NULL;
+    }
+
+    switch (*ps->p) {
+        case '{':
+            v->type = JSON_OBJECT;
+            if (parse_container(ps, v, depth) == NULL) {
+                goto out_err;
+            }
+            break;
+        case '[':
+            v->type = JSON_ARRAY;
+            if (parse_container(ps, v, depth) == NULL) {
+                goto out_err;
+            }
+            break;
+        case '"':
+            v->type = JSON_STRING;
+            v->string = parse_string(ps);
+            if (v->string == NULL) {
+                goto out_err;
+            }
+            break;
+        case 't':
+        case 'f':
+        case 'n':
+            if (!need(ps, *ps->p == 'f' ? 5 : 4)) {
+                goto out_err;
+            }
+            if (strncmp(ps->p, "true", 4) == 0) {
+                v->type = JSON_TRUE;
+                ps->p += 4;
+            } else if (strncmp(ps->p, "false", 5) == 0) {
+                v->type = JSON_FALSE;
+                ps->p += 5;
+            } else if (strncmp(ps->p, "null", 4) == 0) {
+                v->type = JSON_NULL;
+                ps->p += 4;
+            } else {
+                ps->err = EINVAL;
+                goto out_err;
+            }
+            break;
+        default:
+            /* a number may continue in the next read */
+            end = (char*) ps->p;
+            while (end < ps->end && strchr("+-0123456789.eE", *end)) {
+                end++;
+            }
+            if (end == ps->end) {
+                ps->err = EAGAIN;
+                goto out_err;
+            }
+            v->type = JSON_NUMBER;
+            v->number = strtod(ps->p, &end);
+            if (end == ps->p) {
+                ps->err = EINVAL;
+                goto out_err;
+            }
+            ps->p = end;
+            break;
+    }
+
+    return v;
+
+out_err:
+    json_free(v);
+    return NULL;
+}
+
+
+struct json* json_parse(const char* buf, size_t len, size_t* used)
+{
+    struct json* v;
+    struct parser ps;
+
+    ps.p = buf;
+    ps.end = buf + len;
+    ps.err = 0;
+
+    v = parse_value(&ps, 0);
+    if (v == NULL) {
+        errno = ps.err;
+        return NULL;
+    }
+
+    *used = ps.p - buf;
+
+    return v;
+}
+
+void json_free(struct json* v)
+{
+    struct json* next;
+
+    while (v) {
+        next = v->next;
+
+        json_free(v->child);
+        free(v->key);
+        free(v->string);
+        free(v);
+
+        v = next;
+    }
+}
+
+struct json* json_get(const struct json* obj, const char* key)
+{
+    struct json* v;
+
+    if (obj == NULL || obj->type != JSON_OBJECT) {
+        return NULL;
+    }
+
+    for (v = obj->child; v; v = v->next) {
+        if (strcmp(v->key, key) == 0) {
+            return v;
+        }
+    }
+
+    return NULL;
+}
+
+struct json* json_index(const struct json* arr, unsigned int i)
+{
+    struct json* v;
+
+    if (arr == NULL || arr->type != JSON_ARRAY) {
+        return NULL;
+    }
+
+    for (v = arr->child; v && i; v = v->next) {
+        i--;
+    }
+
+    return v;
+}
+
+unsigned int json_length(const struct json* arr)
+{
+    unsigned int n = 0;
+    struct json* v;
+
+    if (arr == NULL || (arr->type != JSON_ARRAY && arr->type != JSON_OBJECT)) {
+        return 0;
+    }
+
+    for (v = arr->child; v; v = v->next) {
+        n++;
+    }
+
+    return n;
+}
+
+const char* json_string(const struct json* v)
+{
+    return v && v->type == JSON_STRING ? v->string : NULL;
+}
+
+
+void json_buf_init(struct json_buf* b)
+{
+    memset(b, 0, sizeof(struct json_buf));
+}
+
+void json_buf_free(struct json_buf* b)
+{
+    free(b->data);
+    json_buf_init(b);
+}
+
+static int reserve(struct json_buf* b, size_t n)
+{
+    char* data;
+    size_t size;
+
+    if (b->err) {
+        return 0;
+    }
+    if (b->len + n + 1 <= b->size) {
+        return 1;
+    }
+
+    size = b->size ? b->size : 256;
+    while (size < b->len + n + 1) {
+        size *= 2;
+    }
+
+    data = realloc(b->data, size);
+    if (data == NULL) {
+        b->err = ENOMEM;
+        return 0;
+    }
+
+    b->data = data;
+    b->size = size;
+
+    return 1;
+}
+
+void json_buf_printf(struct json_buf* b, const char* fmt, ...)
+{
+    int n;
+    va_list ap;
+
+    va_start(ap, fmt);
+    n = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+
+    if (n < 0 || !reserve(b, n)) {
+        return;
+    }
+
+    va_start(ap, fmt);
+    vsnprintf(b->data + b->len, n + 1, fmt, ap);
+    va_end(ap);
+
+    b->len += n;
+}
+
+void json_buf_string(struct json_buf* b, const char* s)
+{
+    /* worst case every byte becomes \u00XX */
+    if (!reserve(b, strlen(s) * 6 + 2)) {
+        return;
+    }
+
+    b->data[b->len++] = '"';
+
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            b->data[b->len++] = '\\';
+            b->data[b->len++] = *s;
+        } else if ((unsigned char) *s < 0x20) {
+            b->len += sprintf(b->data + b->len, "\\u%04x", (unsigned char) *s);
+        } else {
+            b->data[b->len++] = *s;
+        }
+    }
+
+    b->data[b->len++] = '"';
+    b->data[b->len] = '\0';
+}
+
+void json_buf_value(struct json_buf* b, const struct json* v)
+{
+    struct json* item;
+
+    switch (v->type) {
+        case JSON_NULL:
+            json_buf_printf(b, "null");
+            break;
+        case JSON_FALSE:
+            json_buf_printf(b, "false");
+            break;
+        case JSON_TRUE:
+            json_buf_printf(b, "true");
+            break;
+        case JSON_NUMBER:
+            json_buf_printf(b, "%.17g", v->number);
+            break;
+        case JSON_STRING:
+            json_buf_string(b, v->string);
+            break;
+        case JSON_ARRAY:
+        case JSON_OBJECT:
+            json_buf_printf(b, v->type == JSON_ARRAY ? "[" : "{");
+            for (item = v->child; item; item = item->next) {
+                if (v->type == JSON_OBJECT) {
+                    json_buf_string(b, item->key);
+                    json_buf_printf(b, ":");
+                }
+                json_buf_value(b, item);
+                if (item->next) {
+                    json_buf_printf(b, ",");
+                }
+            }
+            json_buf_printf(b, v->type == JSON_ARRAY ? "]" : "}");
+            break;
+    }
+}
@@ -0,0 +1,528 @@
+/*
+ * xendevd
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *
+ *
+ * Copyright (c) 2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <xdd/log.h>
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+
+/* Must be a power of two */
+#define LOG_RING_SIZE       4096
+
+/* The writer drains the ring and refills the rate limit this often */
+#define LOG_TICK_MS         10
+
+/* Drops are reported at most this often */
+#define LOG_DROP_REPORT_MS  1000
+
+#define JOURNAL_SOCKET      "/run/systemd/journal/socket"
+
+struct log_record {
+    /* sequence number of the slot, see ring_push() */
+    uint64_t seq;
+
+    uint64_t ts;
+    int prio;
+    int err;
+    char device[32];
+    char xb_path[96];
+    char msg[160];
+};
+
+struct log {
+    int level;
+    unsigned int rate;
+
+    int journal_fd;
+    struct sockaddr_un journal_addr;
+    FILE* file;
+
+    pthread_t writer;
+    int stop;
+
+    struct log_record* ring;
+    uint64_t tail;
+    uint64_t head;
+
+    /* rate limit tokens, refilled by the writer */
+    int64_t tokens;
+
+    uint64_t written;
+    uint64_t dropped_full;
+    uint64_t dropped_rate;
+    uint64_t reported_full;
+    uint64_t reported_rate;
+    uint64_t reported_at;
+};
+
+static struct log* logger;
+
+static const char* level_names[] = {
+    [LOG_EMERG]   = "emerg",
+    [LOG_ALERT]   = "alert",
+    [LOG_CRIT]    = "crit",
+    [LOG_ERR]     = "err",
+    [LOG_WARNING] = "warning",
+    [LOG_NOTICE]  = "notice",
+    [LOG_INFO]    = "info",
+    [LOG_DEBUG]   = "debug",
+};
+
+
+/*
+ * Bounded MPSC ring (after D. Vyukov's bounded queue). A slot is free for
+ * the producer at position pos when its seq equals pos and holds a record
+ * for the consumer when seq equals pos + 1.
+ */
+static struct log_record* ring_claim(struct log* l, uint64_t* pos)
+{
+    int64_t dif;
+    uint64_t seq;
+    struct log_record* rec;
+
+    *pos = __atomic_load_n(&l->tail, __ATOMIC_RELAXED);
+
+    while (1) {
+        rec = &l->ring[*pos & (LOG_RING_SIZE - 1)];
+        seq = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+        dif = (int64_t) seq - (int64_t) *pos;
+
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&l->tail, pos, *pos + 1, 1,
+                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                return rec;
+            }
+        } else if (dif < 0) {
+            return NULL;
+        } else {
+            *pos = __atomic_load_n(&l->tail, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static void ring_push(struct log_record* rec, uint64_t pos)
+{
+    __atomic_store_n(&rec->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+static struct log_record* ring_peek(struct log* l)
+{
+    struct log_record* rec = &l->ring[l->head & (LOG_RING_SIZE - 1)];
+
+    if (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != l->head + 1) {
+        return NULL;
+    }
+
+    return rec;
+}
+
+static void ring_pop(struct log* l, struct log_record* rec)
+{
+    __atomic_store_n(&rec->seq, l->head + LOG_RING_SIZE, __ATOMIC_RELEASE);
+    l->head++;
+}
+
+static int take_token(struct log* l)
+{
+    int64_t tokens = __atomic_load_n(&l->tokens, __ATOMIC_RELAXED);
+
+    do {
+        if (tokens <= 0) {
+            return 0;
+        }
+    } while (!__atomic_compare_exchange_n(&l->tokens, &tokens, tokens - 1, 1,
+                __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    return 1;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Records are single line, both outputs rely on it */
+static void copy_field(char* dst, size_t size, const char* src)
+{
+    size_t i;
+
+    for (i = 0; src && src[i] && i < size - 1; i++) {
+        dst[i] = src[i] == '\n' ? ' ' : src[i];
+    }
+    dst[i] = '\0';
+}
+
+
+/* writer */
+
+/* Fails rather than blocks while journald is behind */
+static int write_journal(struct log* l, struct log_record* rec)
+{
+    int len;
+    char buf[512];
+
+    len = snprintf(buf, sizeof(buf),
+            "PRIORITY=%d\nSYSLOG_IDENTIFIER=xendevd\nMESSAGE=%s\n",
+            rec->prio, rec->msg);
+    if (rec->device[0] && len < sizeof(buf)) {
+        len += snprintf(buf + len, sizeof(buf) - len, "XDD_DEVICE=%s\n", rec->device);
+    }
+    if (rec->xb_path[0] && len < sizeof(buf)) {
+        len += snprintf(buf + len, sizeof(buf) - len, "XDD_XENBUS_PATH=%s\n", rec->xb_path);
+    }
+    if (rec->err && len < sizeof(buf)) {
+        len += snprintf(buf + len, sizeof(buf) - len, "ERRNO=%d\n", rec->err);
+    }
+    if (len >= sizeof(buf)) {
+        len = sizeof(buf) - 1;
+    }
+
+    if (sendto(l->journal_fd, buf, len, MSG_NOSIGNAL | MSG_DONTWAIT,
+                (struct sockaddr*) &l->journal_addr, sizeof(l->journal_addr)) < 0) {
+        return errno;
+    }
+
+    return 0;
+}
+
+static void write_file(struct log* l, struct log_record* rec)
+{
+    char ts[32];
+    time_t secs = rec->ts / 1000000000;
+    struct tm tm;
+
+    gmtime_r(&secs, &tm);
+    strftime(ts, sizeof(ts), "%Y-%m-%dT%H:%M:%S", &tm);
+
+    fprintf(l->file, "%s.%06luZ level=%s", ts,
+            (unsigned long) (rec->ts % 1000000000) / 1000, level_names[rec->prio]);
+    if (rec->device[0]) {
+        fprintf(l->file, " device=%s", rec->device);
+    }
+    if (rec->xb_path[0]) {
+        fprintf(l->file, " path=%s", rec->xb_path);
+    }
+    if (rec->err) {
+        fprintf(l->file, " errno=%d", rec->err);
+    }
+    fprintf(l->file, " msg=\"%s\"\n", rec->msg);
+}
+
+static void write_record(struct log* l, struct log_record* rec)
+{
+    int err = 0;
+
+    if (l->journal_fd >= 0) {
+        err = write_journal(l, rec);
+    } else {
+        write_file(l, rec);
+    }
+
+    /* e.g. EAGAIN while journald is behind, as lost as with a full ring */
+    if (err) {
+        __atomic_add_fetch(&l->dropped_full, 1, __ATOMIC_RELAXED);
+    } else {
+        __atomic_add_fetch(&l->written, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/* Drops are reported in band */
+static void report_drops(struct log* l, int force)
+{
+    struct log_record rec;
+    uint64_t now = monotonic_ns();
+    uint64_t full = __atomic_load_n(&l->dropped_full, __ATOMIC_RELAXED);
+    uint64_t rate = __atomic_load_n(&l->dropped_rate, __ATOMIC_RELAXED);
+
+    if (full == l->reported_full && rate == l->reported_rate) {
+        return;
+    }
+
+    if (!force && now - l->reported_at < (uint64_t) LOG_DROP_REPORT_MS * 1000000) {
+        return;
+    }
+    l->reported_at = now;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.ts = now_ns();
+    rec.prio = LOG_WARNING;
+    snprintf(rec.msg, sizeof(rec.msg), "Dropped %llu log records (ring or journal full) and %llu (rate limited)",
+            (unsigned long long) (full - l->reported_full),
+            (unsigned long long) (rate - l->reported_rate));
+    write_record(l, &rec);
+
+    l->reported_full = full;
+    l->reported_rate = rate;
+}
+
+static void* writer_main(void* arg)
+{
+    int stop;
+    int64_t add;
+    int64_t burst;
+    uint64_t refilled;
+    struct log_record* rec;
+    struct log* l = arg;
+    struct timespec tick = { 0, LOG_TICK_MS * 1000000 };
+
+    burst = l->rate ? l->rate : 1;
+    refilled = monotonic_ns();
+
+    while (1) {
+        stop = __atomic_load_n(&l->stop, __ATOMIC_ACQUIRE);
+
+        while ((rec = ring_peek(l)) != NULL) {
+            write_record(l, rec);
+            ring_pop(l, rec);
+        }
+
+        report_drops(l, stop);
+
+        if (l->file) {
+            fflush(l->file);
+        }
+
+        if (stop) {
+            break;
+        }
+
+        nanosleep(&tick, NULL);
+
+        /* whole tokens only, the remainder carries over to the next tick */
+        if (l->rate) {
+            add = (monotonic_ns() - refilled) * l->rate / 1000000000;
+            if (add > 0) {
+                refilled += add * 1000000000 / l->rate;
+                if (__atomic_add_fetch(&l->tokens, add, __ATOMIC_RELAXED) > burst) {
+                    __atomic_store_n(&l->tokens, burst, __ATOMIC_RELAXED);
+                }
+            }
+        }
+    }
+
+    return NULL;
+}
+
+
+int log_open(const char* target, int level, unsigned int rate)
+{
+    int err;
+    uint64_t i;
+    struct log* l;
+
+    l = calloc(1, sizeof(struct log));
+    if (l == NULL) {
+        return ENOMEM;
+    }
+
+    l->level = level;
+    l->rate = rate;
+    l->tokens = rate ? rate : INT64_MAX;
+    l->journal_fd = -1;
+
+    l->ring = calloc(LOG_RING_SIZE, sizeof(struct log_record));
+    if (l->ring == NULL) {
+        err = ENOMEM;
+        goto out_err;
+    }
+    for (i = 0; i < LOG_RING_SIZE; i++) {
+        l->ring[i].seq = i;
+    }
+
+    if (strcmp(target, LOG_TARGET_JOURNAL) == 0) {
+        l->journal_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (l->journal_fd < 0) {
+            err = errno;
+            goto out_err;
+        }
+        l->journal_addr.sun_family = AF_UNIX;
+        strcpy(l->journal_addr.sun_path, JOURNAL_SOCKET);
+    } else if (strcmp(target, LOG_TARGET_STDERR) == 0) {
+        l->file = fdopen(dup(STDERR_FILENO), "w");
+    } else {
+        l->file = fopen(target, "ae");
+    }
+
+    if (l->journal_fd < 0 && l->file == NULL) {
+        err = errno;
+        goto out_err;
+    }
+
+    err = pthread_create(&l->writer, NULL, writer_main, l);
+    if (err) {
+        goto out_err;
+    }
+
+    __atomic_store_n(&logger, l, __ATOMIC_RELEASE);
+
+    return 0;
+
+out_err:
+    if (l->journal_fd >= 0) {
+        close(l->journal_fd);
+    }
+    if (l->file) {
+        fclose(l->file);
+    }
+    free(l->ring);
+    free(l);
+    return err;
+}
+
+void log_close(void)
+{
+    struct log* l = logger;
+
+    if (l == NULL) {
+        return;
+    }
+
+    __atomic_store_n(&logger, NULL, __ATOMIC_RELEASE);
+
+    __atomic_store_n(&l->stop, 1, __ATOMIC_RELEASE);
+    pthread_join(l->writer, NULL);
+
+    if (l->journal_fd >= 0) {
+        close(l->journal_fd);
+    }
+    if (l->file) {
+        fclose(l->file);
+    }
+    free(l->ring);
+    free(l);
+}
+
+void log_msg(int prio, const char* device, const char* xb_path, int err, const char* fmt, ...)
+{
+    va_list ap;
+    uint64_t pos;
+    struct log_record* rec;
+    struct log* l = __atomic_load_n(&logger, __ATOMIC_ACQUIRE);
+
+    if (l == NULL || prio > l->level) {
+        return;
+    }
+
+    if (!take_token(l)) {
+        __atomic_add_fetch(&l->dropped_rate, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    rec = ring_claim(l, &pos);
+    if (rec == NULL) {
+        __atomic_add_fetch(&l->dropped_full, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    rec->ts = now_ns();
+    rec->prio = prio;
+    rec->err = err;
+    copy_field(rec->device, sizeof(rec->device), device);
+    copy_field(rec->xb_path, sizeof(rec->xb_path), xb_path);
+
+    va_start(ap, fmt);
+    vsnprintf(rec->msg, sizeof(rec->msg), fmt, ap);
+    va_end(ap);
+    copy_field(rec->msg, sizeof(rec->msg), rec->msg);
+
+    ring_push(rec, pos);
+}
+
+int log_level_parse(const char* name)
+{
+    int i;
+
+    for (i = 0; i <= LOG_DEBUG; i++) {
+        if (strcmp(name, level_names[i]) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+void log_stats(struct log_stats* st)
+{
+    struct log* l = __atomic_load_n(&logger, __ATOMIC_ACQUIRE);
+
+    memset(st, 0, sizeof(struct log_stats));
+
+    if (l == NULL) {
+        return;
+    }
+
+    st->written = __atomic_load_n(&l->written, __ATOMIC_RELAXED);
+    st->dropped_full = __atomic_load_n(&l->dropped_full, __ATOMIC_RELAXED);
+    st->dropped_rate = __atomic_load_n(&l->dropped_rate, __ATOMIC_RELAXED);
+}
+
+void log_dump(FILE* f)
+{
+    struct log_stats st;
+
+    if (logger == NULL) {
+        return;
+    }
+
+    log_stats(&st);
+
+    fprintf(f, "log written=%llu dropped_full=%llu dropped_rate=%llu\n",
+            (unsigned long long) st.written, (unsigned long long) st.dropped_full,
+            (unsigned long long) st.dropped_rate);
+}
@@ -0,0 +1,136 @@
+/*
+ * xendevd
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *
+ *
+ * Copyright (c) 2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <xdd/notify.h>
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+static int notify_fd = -1;
+static struct sockaddr_un notify_addr;
+static socklen_t notify_addr_len;
+static unsigned int watchdog_interval;
+
+
+int notify_init(void)
+{
+    size_t len;
+    char* pid;
+    char* usec;
+    const char* path = getenv("NOTIFY_SOCKET");
+
+    if (path == NULL) {
+        return 0;
+    }
+
+    len = strlen(path);
+    if (len < 2 || len >= sizeof(notify_addr.sun_path) || (path[0] != '/' && path[0] != '@')) {
+        return EINVAL;
+    }
+
+    memset(&notify_addr, 0, sizeof(notify_addr));
+    notify_addr.sun_family = AF_UNIX;
+    memcpy(notify_addr.sun_path, path, len);
+
+    /* a leading '@' names a socket in the abstract namespace */
+    if (path[0] == '@') {
+        notify_addr.sun_path[0] = '\0';
+    }
+    notify_addr_len = offsetof(struct sockaddr_un, sun_path) + len;
+
+    notify_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (notify_fd < 0) {
+        return errno;
+    }
+
+    /* the watchdog may be meant for another process, e.g. before daemon() */
+    usec = getenv("WATCHDOG_USEC");
+    pid = getenv("WATCHDOG_PID");
+    if (usec && (pid == NULL || strtoul(pid, NULL, 10) == getpid())) {
+        /* ping twice per period as recommended by sd_watchdog_enabled(3) */
+        watchdog_interval = strtoull(usec, NULL, 10) / 2000;
+        if (watchdog_interval == 0 && strtoull(usec, NULL, 10) > 0) {
+            watchdog_interval = 1;
+        }
+    }
+
+    return 0;
+}
+
+int notify_enabled(void)
+{
+    return notify_fd >= 0;
+}
+
+int notify_send(const char* fmt, ...)
+{
+    int len;
+    va_list ap;
+    char buf[256];
+
+    if (notify_fd < 0) {
+        return 0;
+    }
+
+    va_start(ap, fmt);
+    len = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+
+    if (len < 0 || len >= sizeof(buf)) {
+        return EINVAL;
+    }
+
+    if (sendto(notify_fd, buf, len, MSG_NOSIGNAL,
+                (struct sockaddr*) &notify_addr, notify_addr_len) < 0) {
+        return errno;
+    }
+
+    return 0;
+}
+
+unsigned int notify_watchdog_interval(void)
+{
+    return watchdog_interval;
+}
@@ -0,0 +1,754 @@
+/*
+ * xendevd
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *
+ *
+ * Copyright (c) 2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <xdd/iface.h>
+#include <xdd/json.h>
+#include <xdd/ovs.h>
+#include <xdd/probe.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+#define OVS_DB          "Open_vSwitch"
+#define OVS_BATCH       256
+#define OVS_TIMEOUT_MS  5000
+
+/*
+ * A pending attach or detach. Whichever caller finds the connection idle
+ * handles everything queued so far and wakes the others when done.
+ */
+struct ovs_req {
+    int add;
+    const char* bridge;
+    const char* vif;
+    const struct vif_ids* ids;
+
+    int err;
+    int done;
+
+    struct ovs_req* next;
+};
+
+struct ovs {
+    struct vif_backend be;
+
+    char* path;
+    int fd;
+    unsigned long id;
+
+    char* buf;
+    size_t len;
+    size_t size;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct ovs_req* head;
+    struct ovs_req** tail;
+    int busy;
+};
+
+
+static void ovs_disconnect(struct ovs* ovs)
+{
+    if (ovs->fd >= 0) {
+        close(ovs->fd);
+    }
+
+    ovs->fd = -1;
+    ovs->len = 0;
+}
+
+static int ovs_connect(struct ovs* ovs)
+{
+    int err;
+    struct sockaddr_un addr;
+
+    if (strlen(ovs->path) >= sizeof(addr.sun_path)) {
+        return ENAMETOOLONG;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, ovs->path);
+
+    ovs->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (ovs->fd < 0) {
+        return errno;
+    }
+
+    err = connect(ovs->fd, (struct sockaddr*) &addr, sizeof(addr));
+    if (err < 0) {
+        err = errno;
+        ovs_disconnect(ovs);
+        return err;
+    }
+
+    return 0;
+}
+
+static int ovs_send(struct ovs* ovs, const char* data, size_t len)
+{
+    ssize_t n;
+
+    while (len) {
+        n = send(ovs->fd, data, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno;
+        }
+
+        data += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/* The server checks liveness with echo requests, which must be answered */
+static int ovs_echo(struct ovs* ovs, const struct json* msg)
+{
+    int err;
+    struct json_buf b;
+    const struct json* params = json_get(msg, "params");
+
+    json_buf_init(&b);
+
+    json_buf_printf(&b, "{\"id\":");
+    json_buf_value(&b, json_get(msg, "id"));
+    json_buf_printf(&b, ",\"result\":");
+    if (params) {
+        json_buf_value(&b, params);
+    } else {
+        json_buf_printf(&b, "[]");
+    }
+    json_buf_printf(&b, ",\"error\":null}");
+
+    err = b.err ? b.err : ovs_send(ovs, b.data, b.len);
+
+    json_buf_free(&b);
+
+    return err;
+}
+
+/* Waits for the reply to request id, answering echoes meanwhile */
+static int ovs_recv(struct ovs* ovs, unsigned long id, struct json** reply)
+{
+    int err;
+    ssize_t n;
+    size_t used;
+    char* buf;
+    const char* method;
+    struct json* msg;
+    struct json* msg_id;
+    struct pollfd pfd;
+
+    while (1) {
+        while (ovs->len) {
+            msg = json_parse(ovs->buf, ovs->len, &used);
+            if (msg == NULL) {
+                if (errno == EAGAIN) {
+                    break;
+                }
+                return EPROTO;
+            }
+
+            memmove(ovs->buf, ovs->buf + used, ovs->len - used);
+            ovs->len -= used;
+
+            method = json_string(json_get(msg, "method"));
+            msg_id = json_get(msg, "id");
+
+            if (method && strcmp(method, "echo") == 0) {
+                err = ovs_echo(ovs, msg);
+                json_free(msg);
+                if (err) {
+                    return err;
+                }
+                continue;
+            }
+
+            if (method == NULL && msg_id && msg_id->type == JSON_NUMBER && msg_id->number == id) {
+                *reply = msg;
+                return 0;
+            }
+
+            /* notifications or replies to requests that timed out */
+            json_free(msg);
+        }
+
+        if (ovs->len == ovs->size) {
+            buf = realloc(ovs->buf, ovs->size ? 2 * ovs->size : 4096);
+            if (buf == NULL) {
+                return ENOMEM;
+            }
+            ovs->buf = buf;
+            ovs->size = ovs->size ? 2 * ovs->size : 4096;
+        }
+
+        pfd.fd = ovs->fd;
+        pfd.events = POLLIN;
+
+        n = poll(&pfd, 1, OVS_TIMEOUT_MS);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return errno;
+        }
+        if (n == 0) {
+            return ETIMEDOUT;
+        }
+
+        n = read(ovs->fd, ovs->buf + ovs->len, ovs->size - ovs->len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return errno;
+        }
+        if (n == 0) {
+            return ECONNRESET;
+        }
+
+        ovs->len += n;
+    }
+}
+
+/*
+ * Runs the comma separated operations in ops as one transaction. On
+ * success *reply holds the server's reply and *result its result array.
+ */
+static int ovs_transact(struct ovs* ovs, const struct json_buf* ops, unsigned int nr_ops,
+        struct json** reply, struct json** result)
+{
+    int err;
+    int fresh;
+    unsigned long id;
+    struct json_buf req;
+
+    json_buf_init(&req);
+
+    while (1) {
+        fresh = ovs->fd < 0;
+        if (fresh) {
+            err = ovs_connect(ovs);
+            if (err) {
+                goto out;
+            }
+        }
+
+        id = ++ovs->id;
+
+        req.len = 0;
+        json_buf_printf(&req, "{\"method\":\"transact\",\"params\":[\"%s\",%s],\"id\":%lu}",
+                OVS_DB, ops->data, id);
+        if (req.err) {
+            err = req.err;
+            goto out;
+        }
+
+        err = ovs_send(ovs, req.data, req.len);
+        if (err == 0) {
+            err = ovs_recv(ovs, id, reply);
+        }
+        if (err == 0) {
+            break;
+        }
+
+        ovs_disconnect(ovs);
+
+        /*
+         * The server may have dropped an idle connection, try once more on
+         * a new one. Replaying is safe, an attach that went through before
+         * shows up as an existing port.
+         */
+        if (fresh || err == ETIMEDOUT || err == EPROTO || err == ENOMEM) {
+            break;
+        }
+    }
+    if (err) {
+        goto out;
+    }
+
+    *result = json_get(*reply, "result");
+    if (*result == NULL || (*result)->type != JSON_ARRAY ||
+            (json_get(*reply, "error") && json_get(*reply, "error")->type != JSON_NULL)) {
+        json_free(*reply);
+        err = EPROTO;
+    }
+
+out:
+    json_buf_free(&req);
+
+    XDD_PROBE2(ovs_transact, nr_ops, err);
+
+    return err;
+}
+
+/* First failed operation of a transaction, commit errors come last */
+static int ovs_result_error(const struct json* result)
+{
+    const char* error;
+    struct json* r;
+
+    for (r = result->child; r; r = r->next) {
+        error = json_string(json_get(r, "error"));
+        if (error == NULL) {
+            continue;
+        }
+
+        if (strcmp(error, "constraint violation") == 0) {
+            return EEXIST;
+        }
+        return EIO;
+    }
+
+    return 0;
+}
+
+static int ovs_count(const struct json* r)
+{
+    struct json* count = json_get(r, "count");
+
+    return count && count->type == JSON_NUMBER ? count->number : -1;
+}
+
+/* The uuid of a ["uuid", ...] pair */
+static const char* ovs_uuid(const struct json* v)
+{
+    const char* tag = json_string(json_index(v, 0));
+
+    if (tag == NULL || strcmp(tag, "uuid") != 0) {
+        return NULL;
+    }
+
+    return json_string(json_index(v, 1));
+}
+
+/* Whether set, either ["set", [...]] or a single atom, contains uuid */
+static int ovs_set_has(const struct json* set, const char* uuid)
+{
+    const char* tag = json_string(json_index(set, 0));
+    const char* u;
+    struct json* v;
+
+    if (tag && strcmp(tag, "set") == 0) {
+        for (v = json_index(set, 1) ? json_index(set, 1)->child : NULL; v; v = v->next) {
+            u = ovs_uuid(v);
+            if (u && strcmp(u, uuid) == 0) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    u = ovs_uuid(set);
+
+    return u && strcmp(u, uuid) == 0;
+}
+
+static void ovs_select_port(struct json_buf* ops, const char* vif)
+{
+    json_buf_printf(ops, "{\"op\":\"select\",\"table\":\"Port\",\"where\":[[\"name\",\"==\",");
+    json_buf_string(ops, vif);
+    json_buf_printf(ops, "]],\"columns\":[\"_uuid\"]}");
+}
+
+/* The bridge, and if port isn't NULL only while it has the port */
+static void ovs_where_bridge(struct json_buf* ops, const char* bridge, const char* port)
+{
+    json_buf_printf(ops, "\"table\":\"Bridge\",\"where\":[[\"name\",\"==\",");
+    json_buf_string(ops, bridge);
+    json_buf_printf(ops, "]");
+    if (port) {
+        json_buf_printf(ops, ",[\"ports\",\"includes\",[\"uuid\",");
+        json_buf_string(ops, port);
+        json_buf_printf(ops, "]]");
+    }
+    json_buf_printf(ops, "]");
+}
+
+/* A [key, value] pair of the external_ids map, if value is known */
+static void ovs_external_id(struct json_buf* ops, const char* key, const char* value, int* first)
+{
+    if (value == NULL) {
+        return;
+    }
+
+    json_buf_printf(ops, "%s[", *first ? "" : ",");
+    json_buf_string(ops, key);
+    json_buf_printf(ops, ",");
+    json_buf_string(ops, value);
+    json_buf_printf(ops, "]");
+    *first = 0;
+}
+
+/* Like vif-openvswitch, for controllers to tell which vif is behind a port */
+static void ovs_external_ids(struct json_buf* ops, const struct vif_ids* ids)
+{
+    int first = 1;
+
+    if (ids == NULL) {
+        return;
+    }
+
+    json_buf_printf(ops, ",\"external_ids\":[\"map\",[");
+    ovs_external_id(ops, "attached-mac", ids->mac, &first);
+    ovs_external_id(ops, "iface-id", ids->iface_id, &first);
+    ovs_external_id(ops, "vm-id", ids->vm_id, &first);
+    json_buf_printf(ops, "]]");
+}
+
+/*
+ * A port with the same name already exists. That's fine if it is on the
+ * bridge already, e.g. for a replayed event.
+ */
+static int ovs_check_port(struct ovs* ovs, const char* bridge, const char* vif)
+{
+    int err;
+    const char* uuid;
+    struct json* reply;
+    struct json* result;
+    struct json* bridges;
+    struct json_buf ops;
+
+    json_buf_init(&ops);
+
+    ovs_select_port(&ops, vif);
+    json_buf_printf(&ops, ",{\"op\":\"select\",");
+    ovs_where_bridge(&ops, bridge, NULL);
+    json_buf_printf(&ops, ",\"columns\":[\"ports\"]}");
+
+    err = ops.err ? ops.err : ovs_transact(ovs, &ops, 2, &reply, &result);
+    json_buf_free(&ops);
+    if (err) {
+        return err;
+    }
+
+    err = ovs_result_error(result);
+    if (err) {
+        goto out;
+    }
+
+    bridges = json_get(json_index(result, 1), "rows");
+    if (json_length(bridges) == 0) {
+        err = ENODEV;
+        goto out;
+    }
+
+    uuid = ovs_uuid(json_get(json_index(json_get(json_index(result, 0), "rows"), 0), "_uuid"));
+    if (uuid == NULL) {
+        /* gone again in the meantime */
+        err = EAGAIN;
+        goto out;
+    }
+
+    /* like the bridge ioctl for an interface on another bridge */
+    if (!ovs_set_has(json_get(json_index(bridges, 0), "ports"), uuid)) {
+        err = EBUSY;
+    }
+
+out:
+    json_free(reply);
+
+    return err;
+}
+
+/*
+ * Adds all ports in one transaction, each as an Interface and a Port row
+ * referenced from its bridge. If that fails as a whole, each port is tried
+ * on its own to find out which one is to blame.
+ */
+static void ovs_add_ports(struct ovs* ovs, struct ovs_req** reqs, unsigned int n)
+{
+    int err;
+    unsigned int i;
+    struct json* reply;
+    struct json* result;
+    struct json_buf ops;
+
+    json_buf_init(&ops);
+
+    for (i = 0; i < n; i++) {
+        json_buf_printf(&ops, "%s{\"op\":\"insert\",\"table\":\"Interface\",\"row\":{\"name\":", i ? "," : "");
+        json_buf_string(&ops, reqs[i]->vif);
+        ovs_external_ids(&ops, reqs[i]->ids);
+        json_buf_printf(&ops, "},\"uuid-name\":\"iface%u\"}", i);
+
+        json_buf_printf(&ops, ",{\"op\":\"insert\",\"table\":\"Port\",\"row\":{\"name\":");
+        json_buf_string(&ops, reqs[i]->vif);
+        json_buf_printf(&ops, ",\"interfaces\":[\"named-uuid\",\"iface%u\"]},\"uuid-name\":\"port%u\"}", i, i);
+
+        json_buf_printf(&ops, ",{\"op\":\"mutate\",");
+        ovs_where_bridge(&ops, reqs[i]->bridge, NULL);
+        json_buf_printf(&ops, ",\"mutations\":[[\"ports\",\"insert\",[\"set\",[[\"named-uuid\",\"port%u\"]]]]]}", i);
+    }
+
+    err = ops.err ? ops.err : ovs_transact(ovs, &ops, 3 * n, &reply, &result);
+    json_buf_free(&ops);
+    if (err) {
+        for (i = 0; i < n; i++) {
+            reqs[i]->err = err;
+        }
+        return;
+    }
+
+    err = ovs_result_error(result);
+
+    if (err == 0) {
+        /* no such bridge, the unreferenced rows are dropped by the server */
+        for (i = 0; i < n; i++) {
+            reqs[i]->err = ovs_count(json_index(result, 3 * i + 2)) > 0 ? 0 : ENODEV;
+        }
+    } else if (n == 1) {
+        reqs[0]->err = err == EEXIST ? ovs_check_port(ovs, reqs[0]->bridge, reqs[0]->vif) : err;
+    } else {
+        for (i = 0; i < n; i++) {
+            ovs_add_ports(ovs, &reqs[i], 1);
+        }
+    }
+
+    json_free(reply);
+}
+
+static void ovs_del_port(struct ovs* ovs, struct ovs_req* req)
+{
+    const char* uuid;
+    struct json* reply;
+    struct json* result;
+    struct json_buf ops;
+
+    json_buf_init(&ops);
+    ovs_select_port(&ops, req->vif);
+
+    req->err = ops.err ? ops.err : ovs_transact(ovs, &ops, 1, &reply, &result);
+    json_buf_free(&ops);
+    if (req->err) {
+        return;
+    }
+
+    uuid = ovs_uuid(json_get(json_index(json_get(json_index(result, 0), "rows"), 0), "_uuid"));
+    if (uuid == NULL) {
+        json_free(reply);
+        req->err = ENODEV;
+        return;
+    }
+
+    /*
+     * The Port and Interface rows go away once unreferenced. A port of
+     * that name on another bridge is left alone and counts as not found.
+     */
+    json_buf_init(&ops);
+    json_buf_printf(&ops, "{\"op\":\"mutate\",");
+    ovs_where_bridge(&ops, req->bridge, uuid);
+    json_buf_printf(&ops, ",\"mutations\":[[\"ports\",\"delete\",[\"uuid\",");
+    json_buf_string(&ops, uuid);
+    json_buf_printf(&ops, "]]]}");
+
+    json_free(reply);
+
+    req->err = ops.err ? ops.err : ovs_transact(ovs, &ops, 1, &reply, &result);
+    json_buf_free(&ops);
+    if (req->err) {
+        return;
+    }
+
+    req->err = ovs_result_error(result);
+    if (req->err == 0 && ovs_count(json_index(result, 0)) <= 0) {
+        req->err = ENODEV;
+    }
+
+    json_free(reply);
+}
+
+static void ovs_run(struct ovs* ovs, struct ovs_req* batch)
+{
+    unsigned int n = 0;
+    struct ovs_req* req;
+    struct ovs_req* adds[OVS_BATCH];
+
+    for (req = batch; req; req = req->next) {
+        if (req->add) {
+            adds[n++] = req;
+        } else {
+            ovs_del_port(ovs, req);
+            XDD_PROBE3(ovs_del_port, req->bridge, req->vif, req->err);
+        }
+    }
+
+    if (n) {
+        ovs_add_ports(ovs, adds, n);
+    }
+
+    for (req = batch; req; req = req->next) {
+        if (req->add) {
+            XDD_PROBE3(ovs_add_port, req->bridge, req->vif, req->err);
+        }
+    }
+}
+
+static int ovs_submit(struct ovs* ovs, struct ovs_req* req)
+{
+    unsigned int n;
+    struct ovs_req* batch;
+    struct ovs_req* next;
+
+    pthread_mutex_lock(&ovs->lock);
+
+    *ovs->tail = req;
+    ovs->tail = &req->next;
+
+    while (!req->done) {
+        if (ovs->busy) {
+            pthread_cond_wait(&ovs->cond, &ovs->lock);
+            continue;
+        }
+
+        /* take over everything queued so far, up to a batch */
+        batch = ovs->head;
+        for (n = 1, next = batch; n < OVS_BATCH && next->next; n++) {
+            next = next->next;
+        }
+        ovs->head = next->next;
+        if (ovs->head == NULL) {
+            ovs->tail = &ovs->head;
+        }
+        next->next = NULL;
+
+        ovs->busy = 1;
+        pthread_mutex_unlock(&ovs->lock);
+
+        ovs_run(ovs, batch);
+
+        pthread_mutex_lock(&ovs->lock);
+        ovs->busy = 0;
+
+        /* waiters may free their request as soon as done is set */
+        for (; batch; batch = next) {
+            next = batch->next;
+            batch->done = 1;
+        }
+
+        pthread_cond_broadcast(&ovs->cond);
+    }
+
+    pthread_mutex_unlock(&ovs->lock);
+
+    return req->err;
+}
+
+static int ovs_attach(struct vif_backend* be, const char* bridge, const char* vif, const struct vif_ids* ids)
+{
+    struct ovs_req req = { .add = 1, .bridge = bridge, .vif = vif, .ids = ids };
+
+    return ovs_submit((struct ovs*) be, &req);
+}
+
+static int ovs_detach(struct vif_backend* be, const char* bridge, const char* vif)
+{
+    struct ovs_req req = { .add = 0, .bridge = bridge, .vif = vif };
+
+    return ovs_submit((struct ovs*) be, &req);
+}
+
+/* ovs-vswitchd doesn't touch the link state of system interfaces */
+static int ovs_set_up(struct vif_backend* be, const char* vif)
+{
+    return iface_set_up(vif);
+}
+
+static int ovs_set_down(struct vif_backend* be, const char* vif)
+{
+    return iface_set_down(vif);
+}
+
+
+struct vif_backend* ovs_backend_new(const char* path)
+{
+    struct ovs* ovs;
+
+    ovs = calloc(1, sizeof(struct ovs));
+    if (ovs == NULL) {
+        return NULL;
+    }
+
+    ovs->path = strdup(path);
+    if (ovs->path == NULL) {
+        free(ovs);
+        return NULL;
+    }
+
+    ovs->be.name = "ovs";
+    ovs->be.needs_ids = 1;
+    ovs->be.attach = ovs_attach;
+    ovs->be.detach = ovs_detach;
+    ovs->be.set_up = ovs_set_up;
+    ovs->be.set_down = ovs_set_down;
+
+    ovs->fd = -1;
+    ovs->tail = &ovs->head;
+
+    pthread_mutex_init(&ovs->lock, NULL);
+    pthread_cond_init(&ovs->cond, NULL);
+
+    return &ovs->be;
+}
+
+void ovs_backend_free(struct vif_backend* be)
+{
+    struct ovs* ovs = (struct ovs*) be;
+
+    if (ovs == NULL) {
+        return;
+    }
+
+    ovs_disconnect(ovs);
+
+    pthread_mutex_destroy(&ovs->lock);
+    pthread_cond_destroy(&ovs->cond);
+
+    free(ovs->buf);
+    free(ovs->path);
+    free(ovs);
+}
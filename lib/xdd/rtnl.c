@@ -0,0 +1,509 @@
+/*
+ * xendevd
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *
+ *
+ * Copyright (c) 2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <xdd/rtnl.h>
+
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <net/if.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <linux/if_link.h>
+#include <linux/ip.h>
+#include <linux/neighbour.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/veth.h>
+
+
+#define RTNL_MSG_SIZE   1024
+
+/* Requests sent at once by rtnl_link_release, well below the socket buffer */
+#define RTNL_BATCH      1024
+
+struct rtnl {
+    int fd;
+    uint32_t seq;
+};
+
+/* attributes follow hdr into buf, so fortified builds want hdr to point at the whole message */
+struct rtnl_msg {
+    struct nlmsghdr hdr;
+    char buf[RTNL_MSG_SIZE];
+};
+
+
+/* RTM_SETLINK clearing IFF_UP and IFLA_MASTER */
+struct rtnl_release_msg {
+    struct nlmsghdr hdr;
+    struct ifinfomsg ifi;
+    struct rtattr master;
+    uint32_t master_index;
+};
+
+
+static void* msg_tail(struct nlmsghdr* hdr)
+{
+    return (char*) hdr + NLMSG_ALIGN(hdr->nlmsg_len);
+}
+
+static int add_attr(struct nlmsghdr* hdr, unsigned short type, const void* data, size_t len)
+{
+    struct rtattr* rta = msg_tail(hdr);
+
+    if (NLMSG_ALIGN(hdr->nlmsg_len) + RTA_SPACE(len) > sizeof(struct rtnl_msg)) {
+        return ENOBUFS;
+    }
+
+    rta->rta_type = type;
+    rta->rta_len = RTA_LENGTH(len);
+    memcpy(RTA_DATA(rta), data, len);
+
+    hdr->nlmsg_len = NLMSG_ALIGN(hdr->nlmsg_len) + RTA_SPACE(len);
+
+    return 0;
+}
+
+static int add_attr_str(struct nlmsghdr* hdr, unsigned short type, const char* str)
+{
+    return add_attr(hdr, type, str, strlen(str) + 1);
+}
+
+static struct rtattr* nest_start(struct nlmsghdr* hdr, unsigned short type)
+{
+    struct rtattr* nest = msg_tail(hdr);
+
+    if (add_attr(hdr, type, NULL, 0)) {
+        return NULL;
+    }
+
+    return nest;
+}
+
+static void nest_end(struct nlmsghdr* hdr, struct rtattr* nest)
+{
+    nest->rta_len = (char*) msg_tail(hdr) - (char*) nest;
+}
+
+static void init_msg(struct rtnl_msg* msg, unsigned short type, unsigned short flags, size_t len)
+{
+    memset(msg, 0, sizeof(struct rtnl_msg));
+
+    msg->hdr.nlmsg_type = type;
+    msg->hdr.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | flags;
+    msg->hdr.nlmsg_len = NLMSG_LENGTH(len);
+}
+
+/* Parses an IPv4 or IPv6 address, returns its family or 0 */
+static int parse_addr(const char* str, unsigned char* addr, size_t* len)
+{
+    if (inet_pton(AF_INET, str, addr) == 1) {
+        *len = 4;
+        return AF_INET;
+    }
+
+    if (inet_pton(AF_INET6, str, addr) == 1) {
+        *len = 16;
+        return AF_INET6;
+    }
+
+    return 0;
+}
+
+/* Sends one request and waits for its acknowledgement */
+static int talk(struct rtnl* nl, struct nlmsghdr* hdr)
+{
+    ssize_t n;
+    char buf[4096];
+    struct nlmsghdr* h;
+    struct nlmsgerr* err;
+
+    hdr->nlmsg_seq = ++nl->seq;
+
+    if (send(nl->fd, hdr, hdr->nlmsg_len, 0) < 0) {
+        return errno;
+    }
+
+    while (1) {
+        n = recv(nl->fd, buf, sizeof(buf), 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno;
+        }
+
+        for (h = (struct nlmsghdr*) buf; NLMSG_OK(h, n); h = NLMSG_NEXT(h, n)) {
+            if (h->nlmsg_seq != hdr->nlmsg_seq || h->nlmsg_type != NLMSG_ERROR) {
+                continue;
+            }
+
+            err = NLMSG_DATA(h);
+            return -err->error;
+        }
+    }
+}
+
+
+/* Sends n requests at once and collects their acknowledgements into errs */
+static int talk_batch(struct rtnl* nl, struct nlmsghdr** reqs, size_t len, unsigned int n, int* errs)
+{
+    ssize_t r;
+    char buf[8192];
+    uint32_t first;
+    unsigned int i;
+    unsigned int pending = n;
+    struct nlmsghdr* h;
+    struct nlmsgerr* err;
+
+    first = nl->seq + 1;
+    for (i = 0; i < n; i++) {
+        reqs[i]->nlmsg_seq = ++nl->seq;
+    }
+
+    /* the requests are contiguous, starting at the first */
+    if (send(nl->fd, reqs[0], len, 0) < 0) {
+        return errno;
+    }
+
+    while (pending) {
+        r = recv(nl->fd, buf, sizeof(buf), 0);
+        if (r < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno;
+        }
+
+        for (h = (struct nlmsghdr*) buf; NLMSG_OK(h, r); h = NLMSG_NEXT(h, r)) {
+            if (h->nlmsg_type != NLMSG_ERROR || h->nlmsg_seq - first >= n) {
+                continue;
+            }
+
+            err = NLMSG_DATA(h);
+            errs[h->nlmsg_seq - first] = -err->error;
+            pending--;
+        }
+    }
+
+    return 0;
+}
+
+
+struct rtnl* rtnl_open(void)
+{
+    struct rtnl* nl;
+    struct sockaddr_nl addr;
+
+    nl = calloc(1, sizeof(struct rtnl));
+    if (nl == NULL) {
+        return NULL;
+    }
+
+    nl->fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (nl->fd < 0) {
+        free(nl);
+        return NULL;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+
+    if (bind(nl->fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+        close(nl->fd);
+        free(nl);
+        return NULL;
+    }
+
+    return nl;
+}
+
+void rtnl_close(struct rtnl* nl)
+{
+    close(nl->fd);
+    free(nl);
+}
+
+int rtnl_link_add(struct rtnl* nl, const char* name, const char* kind, const char* peer)
+{
+    struct rtnl_msg msg;
+    struct rtattr* linkinfo;
+    struct rtattr* data;
+    struct rtattr* peer_info;
+
+    init_msg(&msg, RTM_NEWLINK, NLM_F_CREATE | NLM_F_EXCL, sizeof(struct ifinfomsg));
+
+    if (add_attr_str(&msg.hdr, IFLA_IFNAME, name)) {
+        return ENOBUFS;
+    }
+
+    linkinfo = nest_start(&msg.hdr, IFLA_LINKINFO);
+    if (linkinfo == NULL || add_attr_str(&msg.hdr, IFLA_INFO_KIND, kind)) {
+        return ENOBUFS;
+    }
+
+    if (peer) {
+        data = nest_start(&msg.hdr, IFLA_INFO_DATA);
+        peer_info = nest_start(&msg.hdr, VETH_INFO_PEER);
+        if (data == NULL || peer_info == NULL) {
+            return ENOBUFS;
+        }
+
+        /* the peer is described by an ifinfomsg followed by its attributes */
+        msg.hdr.nlmsg_len += NLMSG_ALIGN(sizeof(struct ifinfomsg));
+        if (add_attr_str(&msg.hdr, IFLA_IFNAME, peer)) {
+            return ENOBUFS;
+        }
+
+        nest_end(&msg.hdr, peer_info);
+        nest_end(&msg.hdr, data);
+    }
+
+    nest_end(&msg.hdr, linkinfo);
+
+    return talk(nl, &msg.hdr);
+}
+
+int rtnl_link_del(struct rtnl* nl, const char* name)
+{
+    struct rtnl_msg msg;
+    struct ifinfomsg* ifi;
+
+    init_msg(&msg, RTM_DELLINK, 0, sizeof(struct ifinfomsg));
+
+    ifi = NLMSG_DATA(&msg.hdr);
+    ifi->ifi_family = AF_UNSPEC;
+    ifi->ifi_index = if_nametoindex(name);
+    if (ifi->ifi_index == 0) {
+        return ENODEV;
+    }
+
+    return talk(nl, &msg.hdr);
+}
+
+int rtnl_link_release(struct rtnl* nl, const char** devs, unsigned int n, int* errs)
+{
+    int err = 0;
+    unsigned int i;
+    unsigned int count;
+    unsigned int done;
+    unsigned int idx[RTNL_BATCH];
+    int res[RTNL_BATCH];
+    struct nlmsghdr* reqs[RTNL_BATCH];
+    struct rtnl_release_msg* msgs;
+    struct rtnl_release_msg* m;
+
+    msgs = calloc(n < RTNL_BATCH ? n : RTNL_BATCH, sizeof(struct rtnl_release_msg));
+    if (msgs == NULL) {
+        return ENOMEM;
+    }
+
+    for (done = 0; done < n && err == 0; done = i) {
+        count = 0;
+
+        for (i = done; i < n && count < RTNL_BATCH; i++) {
+            m = &msgs[count];
+            memset(m, 0, sizeof(struct rtnl_release_msg));
+
+            m->ifi.ifi_family = AF_UNSPEC;
+            m->ifi.ifi_index = if_nametoindex(devs[i]);
+            if (m->ifi.ifi_index == 0) {
+                errs[i] = ENODEV;
+                continue;
+            }
+            m->ifi.ifi_change = IFF_UP;
+
+            m->master.rta_type = IFLA_MASTER;
+            m->master.rta_len = RTA_LENGTH(sizeof(uint32_t));
+
+            m->hdr.nlmsg_type = RTM_SETLINK;
+            m->hdr.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+            m->hdr.nlmsg_len = sizeof(struct rtnl_release_msg);
+
+            reqs[count] = &m->hdr;
+            idx[count] = i;
+            count++;
+        }
+
+        if (count == 0) {
+            continue;
+        }
+
+        err = talk_batch(nl, reqs, count * sizeof(struct rtnl_release_msg), count, res);
+
+        while (count--) {
+            errs[idx[count]] = err ? err : res[count];
+        }
+    }
+
+    for (; done < n; done++) {
+        errs[done] = err;
+    }
+
+    free(msgs);
+
+    return err;
+}
+
+int rtnl_link_proxy_arp(struct rtnl* nl, const char* dev, int on)
+{
+    uint32_t value = on;
+    struct rtnl_msg msg;
+    struct nlmsghdr* hdr = (struct nlmsghdr*) &msg;
+    struct ifinfomsg* ifi;
+    struct rtattr* af_spec;
+    struct rtattr* inet;
+    struct rtattr* conf;
+
+    init_msg(&msg, RTM_SETLINK, 0, sizeof(struct ifinfomsg));
+
+    ifi = NLMSG_DATA(hdr);
+    ifi->ifi_family = AF_UNSPEC;
+    ifi->ifi_index = if_nametoindex(dev);
+    if (ifi->ifi_index == 0) {
+        return ENODEV;
+    }
+
+    /* devconf entries are attributes typed by their index */
+    af_spec = nest_start(hdr, IFLA_AF_SPEC);
+    inet = nest_start(hdr, AF_INET);
+    conf = nest_start(hdr, IFLA_INET_CONF);
+    if (af_spec == NULL || inet == NULL || conf == NULL ||
+            add_attr(hdr, IPV4_DEVCONF_PROXY_ARP, &value, sizeof(value))) {
+        return ENOBUFS;
+    }
+
+    nest_end(hdr, conf);
+    nest_end(hdr, inet);
+    nest_end(hdr, af_spec);
+
+    return talk(nl, hdr);
+}
+
+static int route(struct rtnl* nl, unsigned short type, const char* dev, const char* addr)
+{
+    int family;
+    size_t len;
+    uint32_t ifindex;
+    unsigned char dst[16];
+    struct rtnl_msg msg;
+    struct nlmsghdr* hdr = (struct nlmsghdr*) &msg;
+    struct rtmsg* rtm;
+
+    family = parse_addr(addr, dst, &len);
+    if (family == 0) {
+        return EINVAL;
+    }
+
+    ifindex = if_nametoindex(dev);
+    if (ifindex == 0) {
+        return ENODEV;
+    }
+
+    /* replacing makes adding idempotent, e.g. for replayed events */
+    init_msg(&msg, type, type == RTM_NEWROUTE ? NLM_F_CREATE | NLM_F_REPLACE : 0, sizeof(struct rtmsg));
+
+    rtm = NLMSG_DATA(hdr);
+    rtm->rtm_family = family;
+    rtm->rtm_dst_len = len * 8;
+    rtm->rtm_table = RT_TABLE_MAIN;
+    rtm->rtm_protocol = RTPROT_STATIC;
+    rtm->rtm_scope = family == AF_INET ? RT_SCOPE_LINK : RT_SCOPE_UNIVERSE;
+    rtm->rtm_type = RTN_UNICAST;
+
+    if (add_attr(hdr, RTA_DST, dst, len) ||
+            add_attr(hdr, RTA_OIF, &ifindex, sizeof(ifindex))) {
+        return ENOBUFS;
+    }
+
+    return talk(nl, hdr);
+}
+
+int rtnl_route_add(struct rtnl* nl, const char* dev, const char* addr)
+{
+    return route(nl, RTM_NEWROUTE, dev, addr);
+}
+
+int rtnl_route_del(struct rtnl* nl, const char* dev, const char* addr)
+{
+    return route(nl, RTM_DELROUTE, dev, addr);
+}
+
+static int neigh_proxy(struct rtnl* nl, unsigned short type, const char* dev, const char* addr)
+{
+    int family;
+    size_t len;
+    unsigned char dst[16];
+    struct rtnl_msg msg;
+    struct nlmsghdr* hdr = (struct nlmsghdr*) &msg;
+    struct ndmsg* ndm;
+
+    family = parse_addr(addr, dst, &len);
+    if (family == 0) {
+        return EINVAL;
+    }
+
+    init_msg(&msg, type, type == RTM_NEWNEIGH ? NLM_F_CREATE | NLM_F_REPLACE : 0, sizeof(struct ndmsg));
+
+    ndm = NLMSG_DATA(hdr);
+    ndm->ndm_family = family;
+    ndm->ndm_ifindex = if_nametoindex(dev);
+    ndm->ndm_flags = NTF_PROXY;
+    ndm->ndm_state = NUD_PERMANENT;
+    if (ndm->ndm_ifindex == 0) {
+        return ENODEV;
+    }
+
+    if (add_attr(hdr, NDA_DST, dst, len)) {
+        return ENOBUFS;
+    }
+
+    return talk(nl, hdr);
+}
+
+int rtnl_neigh_proxy_add(struct rtnl* nl, const char* dev, const char* addr)
+{
+    return neigh_proxy(nl, RTM_NEWNEIGH, dev, addr);
+}
+
+int rtnl_neigh_proxy_del(struct rtnl* nl, const char* dev, const char* addr)
+{
+    return neigh_proxy(nl, RTM_DELNEIGH, dev, addr);
+}
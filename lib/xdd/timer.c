@@ -0,0 +1,224 @@
+/*
+ * xendevd
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *
+ *
+ * Copyright (c) 2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <xdd/timer.h>
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+
+struct timer {
+    uint64_t due;
+    timer_cb cb;
+    void* arg;
+
+    struct timer* next;
+};
+
+struct timer_queue {
+    int fd;
+    pthread_mutex_t lock;
+
+    unsigned int pending;
+    struct timer* head;
+};
+
+
+uint64_t timer_now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+struct timer_queue* timer_queue_new(void)
+{
+    struct timer_queue* tq;
+
+    tq = calloc(1, sizeof(struct timer_queue));
+    if (tq == NULL) {
+        return NULL;
+    }
+
+    tq->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (tq->fd < 0) {
+        free(tq);
+        return NULL;
+    }
+
+    pthread_mutex_init(&tq->lock, NULL);
+
+    return tq;
+}
+
+void timer_queue_free(struct timer_queue* tq)
+{
+    struct timer* t;
+
+    while (tq->head) {
+        t = tq->head;
+        tq->head = t->next;
+        free(t);
+    }
+
+    close(tq->fd);
+    pthread_mutex_destroy(&tq->lock);
+    free(tq);
+}
+
+int timer_add(struct timer_queue* tq, unsigned int delay_ms, timer_cb cb, void* arg)
+{
+    ssize_t ret;
+    uint64_t one = 1;
+    struct timer* t;
+    struct timer** link;
+
+    t = malloc(sizeof(struct timer));
+    if (t == NULL) {
+        return ENOMEM;
+    }
+
+    t->due = timer_now_ms() + delay_ms;
+    t->cb = cb;
+    t->arg = arg;
+
+    pthread_mutex_lock(&tq->lock);
+
+    /* kept sorted by due time, equal times in insertion order */
+    link = &tq->head;
+    while (*link && (*link)->due <= t->due) {
+        link = &(*link)->next;
+    }
+    t->next = *link;
+    *link = t;
+    tq->pending++;
+
+    pthread_mutex_unlock(&tq->lock);
+
+    /*
+     * wake up the loop so it picks up the new timeout; EAGAIN means the
+     * counter is saturated, so a wake up is pending anyway
+     */
+    do {
+        ret = write(tq->fd, &one, sizeof(one));
+    } while (ret < 0 && errno == EINTR);
+
+    return 0;
+}
+
+int timer_queue_fileno(struct timer_queue* tq)
+{
+    return tq->fd;
+}
+
+int timer_queue_timeout(struct timer_queue* tq)
+{
+    int timeout = -1;
+    uint64_t now;
+
+    pthread_mutex_lock(&tq->lock);
+
+    if (tq->head) {
+        now = timer_now_ms();
+        timeout = tq->head->due > now ? tq->head->due - now : 0;
+    }
+
+    pthread_mutex_unlock(&tq->lock);
+
+    return timeout;
+}
+
+void timer_queue_run(struct timer_queue* tq)
+{
+    ssize_t ret;
+    uint64_t val;
+    uint64_t now = timer_now_ms();
+    struct timer* due;
+    struct timer* t;
+    struct timer** link;
+
+    /* reset the wake up counter, EAGAIN if the run is for a due timer only */
+    do {
+        ret = read(tq->fd, &val, sizeof(val));
+    } while (ret < 0 && errno == EINTR);
+
+    /*
+     * Detach what is due now, so timers added by the callbacks (even with
+     * no delay) wait for the next run and the loop gets to poll in between.
+     */
+    pthread_mutex_lock(&tq->lock);
+
+    due = NULL;
+    link = &tq->head;
+    while (*link && (*link)->due <= now) {
+        link = &(*link)->next;
+        tq->pending--;
+    }
+    if (link != &tq->head) {
+        due = tq->head;
+        tq->head = *link;
+        *link = NULL;
+    }
+
+    pthread_mutex_unlock(&tq->lock);
+
+    /* callbacks may add timers, so don't hold the lock */
+    while (due) {
+        t = due;
+        due = t->next;
+
+        t->cb(t->arg);
+        free(t);
+    }
+}
+
+unsigned int timer_queue_pending(struct timer_queue* tq)
+{
+    unsigned int pending;
+
+    pthread_mutex_lock(&tq->lock);
+    pending = tq->pending;
+    pthread_mutex_unlock(&tq->lock);
+
+    return pending;
+}
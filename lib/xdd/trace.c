@@ -0,0 +1,212 @@
+/*
+ * xendevd
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *
+ *
+ * Copyright (c) 2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <xdd/trace.h>
+
+#define _GNU_SOURCE
+
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+
+struct trace_file_header {
+    char magic[8];
+    uint32_t version;
+} __attribute__((packed));
+
+struct trace_record_header {
+    uint32_t len;
+    uint64_t ts;
+} __attribute__((packed));
+
+struct trace {
+    int fd;
+    FILE* f;
+    char* buf;
+};
+
+
+uint64_t trace_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+struct trace* trace_open_append(const char* path)
+{
+    struct stat st;
+    struct trace* t;
+    struct trace_file_header hdr;
+
+    t = calloc(1, sizeof(struct trace));
+    if (t == NULL) {
+        return NULL;
+    }
+
+    t->fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (t->fd < 0) {
+        goto out_err;
+    }
+
+    if (fstat(t->fd, &st)) {
+        goto out_err;
+    }
+
+    if (st.st_size == 0) {
+        memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+        hdr.version = htole32(TRACE_VERSION);
+
+        if (write(t->fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+            goto out_err;
+        }
+    }
+
+    return t;
+
+out_err:
+    if (t->fd >= 0) {
+        close(t->fd);
+    }
+    free(t);
+    return NULL;
+}
+
+struct trace* trace_open_read(const char* path)
+{
+    struct trace* t;
+    struct trace_file_header hdr;
+
+    t = calloc(1, sizeof(struct trace));
+    if (t == NULL) {
+        return NULL;
+    }
+
+    t->fd = -1;
+    t->buf = malloc(TRACE_MAX_RECORD);
+    t->f = fopen(path, "re");
+    if (t->buf == NULL || t->f == NULL) {
+        goto out_err;
+    }
+
+    if (fread(&hdr, sizeof(hdr), 1, t->f) != 1 ||
+            memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic)) ||
+            le32toh(hdr.version) != TRACE_VERSION) {
+        errno = EINVAL;
+        goto out_err;
+    }
+
+    return t;
+
+out_err:
+    if (t->f) {
+        fclose(t->f);
+    }
+    free(t->buf);
+    free(t);
+    return NULL;
+}
+
+void trace_close(struct trace* t)
+{
+    if (t->f) {
+        fclose(t->f);
+    } else {
+        close(t->fd);
+    }
+    free(t->buf);
+    free(t);
+}
+
+int trace_append(struct trace* t, uint64_t ts, const char* buf, size_t len)
+{
+    ssize_t n;
+    struct iovec iov[2];
+    struct trace_record_header hdr;
+
+    if (len > TRACE_MAX_RECORD) {
+        return EMSGSIZE;
+    }
+
+    hdr.len = htole32(len);
+    hdr.ts = htole64(ts);
+
+    iov[0].iov_base = &hdr;
+    iov[0].iov_len = sizeof(hdr);
+    iov[1].iov_base = (void*) buf;
+    iov[1].iov_len = len;
+
+    /* one write per record, so concurrent appenders don't interleave */
+    n = writev(t->fd, iov, 2);
+    if (n < 0) {
+        return errno;
+    }
+
+    return n == sizeof(hdr) + len ? 0 : EIO;
+}
+
+int trace_next(struct trace* t, uint64_t* ts, const char** buf, size_t* len)
+{
+    struct trace_record_header hdr;
+
+    if (fread(&hdr, sizeof(hdr), 1, t->f) != 1) {
+        return ferror(t->f) ? EIO : ENODATA;
+    }
+
+    *len = le32toh(hdr.len);
+    *ts = le64toh(hdr.ts);
+
+    if (*len > TRACE_MAX_RECORD) {
+        return EINVAL;
+    }
+
+    if (fread(t->buf, 1, *len, t->f) != *len) {
+        return ferror(t->f) ? EIO : ENODATA;
+    }
+
+    *buf = t->buf;
+
+    return 0;
+}
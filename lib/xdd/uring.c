@@ -0,0 +1,228 @@
+/*
+ * xendevd
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *
+ *
+ * Copyright (c) 2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifdef XDD_URING
+
+#include <xdd/uring.h>
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+struct uring {
+    int fd;
+
+    /* both rings share one mapping */
+    void* rings;
+    size_t rings_size;
+
+    unsigned int* sq_head;
+    unsigned int* sq_tail;
+    unsigned int* sq_mask;
+    unsigned int* sq_array;
+    unsigned int sq_entries;
+    unsigned int sq_local_tail;
+    unsigned int sq_submitted;
+
+    struct io_uring_sqe* sqes;
+    size_t sqes_size;
+
+    unsigned int* cq_head;
+    unsigned int* cq_tail;
+    unsigned int* cq_mask;
+    struct io_uring_cqe* cqes;
+    unsigned int cq_reaped;
+};
+
+
+struct uring* uring_open(unsigned int entries)
+{
+    struct uring* ring;
+    struct io_uring_params p;
+
+    ring = calloc(1, sizeof(struct uring));
+    if (ring == NULL) {
+        return NULL;
+    }
+
+    memset(&p, 0, sizeof(p));
+
+    ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (ring->fd < 0) {
+        free(ring);
+        errno = ENOSYS;
+        return NULL;
+    }
+
+    /* RW_CUR_POS came with 5.6, like the operations we rely on */
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_RW_CUR_POS)) {
+        close(ring->fd);
+        free(ring);
+        errno = ENOSYS;
+        return NULL;
+    }
+
+    ring->rings_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    if (p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe) > ring->rings_size) {
+        ring->rings_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    }
+
+    ring->rings = mmap(NULL, ring->rings_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->rings == MAP_FAILED) {
+        goto out_err;
+    }
+
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        munmap(ring->rings, ring->rings_size);
+        goto out_err;
+    }
+
+    ring->sq_head = (unsigned int*) ((char*) ring->rings + p.sq_off.head);
+    ring->sq_tail = (unsigned int*) ((char*) ring->rings + p.sq_off.tail);
+    ring->sq_mask = (unsigned int*) ((char*) ring->rings + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned int*) ((char*) ring->rings + p.sq_off.array);
+    ring->sq_entries = p.sq_entries;
+    ring->sq_local_tail = *ring->sq_tail;
+    ring->sq_submitted = ring->sq_local_tail;
+
+    ring->cq_head = (unsigned int*) ((char*) ring->rings + p.cq_off.head);
+    ring->cq_tail = (unsigned int*) ((char*) ring->rings + p.cq_off.tail);
+    ring->cq_mask = (unsigned int*) ((char*) ring->rings + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*) ((char*) ring->rings + p.cq_off.cqes);
+
+    return ring;
+
+out_err:
+    close(ring->fd);
+    free(ring);
+    return NULL;
+}
+
+void uring_close(struct uring* ring)
+{
+    munmap(ring->sqes, ring->sqes_size);
+    munmap(ring->rings, ring->rings_size);
+    close(ring->fd);
+    free(ring);
+}
+
+struct io_uring_sqe* uring_get_sqe(struct uring* ring)
+{
+    unsigned int idx;
+    struct io_uring_sqe* sqe;
+    unsigned int head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+    if (ring->sq_local_tail - head >= ring->sq_entries) {
+        return NULL;
+    }
+
+    idx = ring->sq_local_tail & *ring->sq_mask;
+    sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+    ring->sq_array[idx] = idx;
+    ring->sq_local_tail++;
+
+    return sqe;
+}
+
+int uring_submit(struct uring* ring, unsigned int wait_nr)
+{
+    int ret;
+    unsigned int to_submit = ring->sq_local_tail - ring->sq_submitted;
+
+    /* publish the new entries before telling the kernel about them */
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+
+    do {
+        ret = syscall(__NR_io_uring_enter, ring->fd, to_submit, wait_nr,
+                wait_nr ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret < 0) {
+        return errno;
+    }
+
+    ring->sq_submitted += ret;
+
+    return 0;
+}
+
+int uring_wait(struct uring* ring)
+{
+    int ret;
+
+    do {
+        ret = syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+    } while (ret < 0 && errno == EINTR);
+
+    return ret < 0 ? errno : 0;
+}
+
+unsigned int uring_inflight(struct uring* ring)
+{
+    return ring->sq_submitted - ring->cq_reaped;
+}
+
+int uring_next_cqe(struct uring* ring, uint64_t* user_data, int* res)
+{
+    struct io_uring_cqe* cqe;
+    unsigned int head = *ring->cq_head;
+
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        return EAGAIN;
+    }
+
+    cqe = &ring->cqes[head & *ring->cq_mask];
+    *user_data = cqe->user_data;
+    *res = cqe->res;
+
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    ring->cq_reaped++;
+
+    return 0;
+}
+
+#endif /* XDD_URING */
@@ -33,50 +33,61 @@
  *
  */
 
+#include <xdd/blk.h>
 #include <xdd/vbd.h>
 #include <xdd/xs_helper.h>
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
-#include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <unistd.h>
 
 
-int vbd_phy_hotplug_online(struct xs_handle* xs, const char* xb_path, const char* device)
+int vbd_phy_hotplug_report(struct xs_handle* xs, const char* xb_path, const struct blk_check* check)
 {
     char* dev_id;
-    struct stat st;
     char* err_msg = NULL;
 
-    if (stat(device, &st)) {
-        if (errno == ENOENT) {
-            asprintf(&err_msg, "%s does not exist.", device);
-        } else {
-            asprintf(&err_msg, "stat(%s) returned %d.", device, errno);
-        }
-        goto out_err;
-    }
-
-    /* FIXME: Check if dev is block device */
-    if (!S_ISBLK(st.st_mode)) {
-        asprintf(&err_msg, "%s is not a block device.", device);
-        goto out_err;
-    }
+    if (check->err == 0) {
+        /* FIXME: Check device sharing */
 
-    /* FIXME: Check device sharing */
+        asprintf(&dev_id, "%x:%x", major(check->rdev), minor(check->rdev));
+        xs_write_k(xs, dev_id, xb_path, "physical-device");
+        free(dev_id);
 
-    asprintf(&dev_id, "%x:%x", major(st.st_rdev), minor(st.st_rdev));
-    xs_write_k(xs, dev_id, xb_path, "physical-device");
-    free(dev_id);
+        return 0;
+    }
 
-    goto out;
+    switch (check->err) {
+        case ENOENT:
+            asprintf(&err_msg, "%s does not exist.", check->path);
+            break;
+        case ENOTBLK:
+            asprintf(&err_msg, "%s is not a block device.", check->path);
+            break;
+        case ENODEV:
+            asprintf(&err_msg, "%s has no request queue.", check->path);
+            break;
+        default:
+            asprintf(&err_msg, "stat(%s) returned %d.", check->path, check->err);
+            break;
+    }
 
-out_err:
     xs_write_k(xs, err_msg, xb_path, "hotplug-error");
     xs_write_k(xs, "error", xb_path, "hotplug-status");
     free(err_msg);
 
-out:
-    return 0;
+    return check->err;
+}
+
+int vbd_phy_hotplug_online(struct xs_handle* xs, const char* xb_path, const char* device)
+{
+    struct blk_check check;
+
+    check.path = device;
+    blk_check_batch(&check, 1);
+
+    return vbd_phy_hotplug_report(xs, xb_path, &check);
 }
@@ -33,48 +33,168 @@
  *
  */
 
-#include <xdd/bridge.h>
-#include <xdd/iface.h>
+#include <xdd/aimd.h>
+#include <xdd/probe.h>
+#include <xdd/rtnl.h>
 #include <xdd/vif.h>
+#include <xdd/vif_backend.h>
 #include <xdd/xs_helper.h>
 
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
-int vif_hotplug_online(struct xs_handle* xs, const char* xb_path, const char* bridge, const char* vif)
+
+/*
+ * The vif's mac, its domain's uuid, taken from the domain's vm path
+ * (/vm/<uuid>), and as interface id "<uuid>-<devid>", stable across
+ * restarts of the domain unlike the vif's name.
+ */
+static void read_ids(struct xs_handle* xs, const char* xb_path, struct vif_ids* ids)
 {
-    errno = bridge_add_if(bridge, vif);
-    if (errno) {
-        goto out_err;
+    char* domain;
+    char* vm;
+    char* uuid;
+    const char* p;
+    unsigned int domid, devid;
+
+    ids->mac = xs_read_k(xs, xb_path, "mac");
+    ids->vm_id = NULL;
+    ids->iface_id = NULL;
+
+    p = strstr(xb_path, "backend/vif/");
+    if (p == NULL || sscanf(p, "backend/vif/%u/%u", &domid, &devid) != 2) {
+        return;
     }
 
-    errno = iface_set_up(vif);
-    if (errno) {
-        goto out_err;
+    if (asprintf(&domain, "/local/domain/%u", domid) < 0) {
+        return;
+    }
+    vm = xs_read_k(xs, domain, "vm");
+    free(domain);
+
+    uuid = vm ? strrchr(vm, '/') : NULL;
+    if (uuid && uuid[1]) {
+        ids->vm_id = strdup(uuid + 1);
+        if (ids->vm_id && asprintf(&ids->iface_id, "%s-%u", ids->vm_id, devid) < 0) {
+            ids->iface_id = NULL;
+        }
+    }
+
+    free(vm);
+}
+
+static void free_ids(struct vif_ids* ids)
+{
+    free(ids->mac);
+    free(ids->vm_id);
+    free(ids->iface_id);
+}
+
+
+int vif_hotplug_attach(struct xs_handle* xs, const char* xb_path, const char* bridge, const char* vif)
+{
+    int err;
+    struct vif_ids ids;
+    struct vif_backend* be = vif_backend_for(bridge);
+
+    if (be->needs_ids) {
+        read_ids(xs, xb_path, &ids);
+        err = be->attach(be, bridge, vif, &ids);
+        free_ids(&ids);
+    } else {
+        err = be->attach(be, bridge, vif, NULL);
+    }
+    if (err) {
+        return err;
     }
 
-    xs_write_k(xs, "connected", xb_path, "hotplug-status");
+    return be->set_up(be, vif);
+}
 
-    goto out;
+void vif_hotplug_report(struct xs_handle* xs, const char* xb_path, int err)
+{
+    if (err == 0) {
+        xs_write_k(xs, "connected", xb_path, "hotplug-status");
+        return;
+    }
 
-out_err:
     /* FIXME: provide an error description */
     xs_write_k(xs, "failure", xb_path, "hotplug-error");
     xs_write_k(xs, "error", xb_path, "hotplug-status");
+}
+
+int vif_hotplug_transient(int err)
+{
+    switch (err) {
+        /* vif or bridge not registered yet */
+        case ENODEV:
+        case ENXIO:
+        case EAGAIN:
+            return 1;
+    }
 
-out:
     return 0;
 }
 
+int vif_hotplug_online(struct xs_handle* xs, const char* xb_path, const char* bridge, const char* vif)
+{
+    int err;
+
+    err = vif_hotplug_attach(xs, xb_path, bridge, vif);
+    vif_hotplug_report(xs, xb_path, err);
+
+    return err;
+}
+
 int vif_hotplug_offline(struct xs_handle* xs, const char* xb_path, const char* bridge, const char* vif)
 {
-    errno = iface_set_down(vif);
-    if (errno) {
-        return errno;
+    int err;
+    struct vif_backend* be = vif_backend_for(bridge);
+
+    /* the domain is gone and took the vif along, as in vif_hotplug_release */
+    err = be->set_down(be, vif);
+    if (err && err != ENODEV) {
+        return err;
     }
 
-    errno = bridge_rem_if(bridge, vif);
-    if (errno) {
-        return errno;
+    err = be->detach(be, bridge, vif);
+    if (err == ENODEV) {
+        err = 0;
     }
 
-    return 0;
+    return err;
+}
+
+void vif_hotplug_release(const char** vifs, unsigned int n, int* errs)
+{
+    int err;
+    unsigned int i;
+    uint64_t start;
+    struct rtnl* nl;
+
+    nl = rtnl_open();
+    if (nl == NULL) {
+        err = errno;
+        for (i = 0; i < n; i++) {
+            errs[i] = err;
+        }
+        return;
+    }
+
+    start = aimd_enter(AIMD_RTNL);
+    rtnl_link_release(nl, vifs, n, errs);
+    aimd_exit(AIMD_RTNL, start);
+
+    rtnl_close(nl);
+
+    for (i = 0; i < n; i++) {
+        /* the domain is gone and took the vif along */
+        if (errs[i] == ENODEV) {
+            errs[i] = 0;
+        }
+
+        XDD_PROBE2(vif_release, vifs[i], errs[i]);
+    }
 }
@@ -0,0 +1,114 @@
+/*
+ * xendevd
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *
+ *
+ * Copyright (c) 2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <xdd/bridge.h>
+#include <xdd/iface.h>
+#include <xdd/vif_backend.h>
+
+#include <errno.h>
+#include <fnmatch.h>
+
+
+struct vif_backend_mapping {
+    const char* pattern;
+    struct vif_backend* be;
+};
+
+static struct vif_backend_mapping mappings[VIF_BACKEND_MAX];
+static unsigned int nr_mappings;
+
+
+static int bridge_attach(struct vif_backend* be, const char* bridge, const char* vif, const struct vif_ids* ids)
+{
+    int err;
+
+    err = bridge_add_if(bridge, vif);
+    if (err == EBUSY && bridge_has_if(bridge, vif)) {
+        /* already attached, e.g. a replayed event */
+        err = 0;
+    }
+
+    return err;
+}
+
+static int bridge_detach(struct vif_backend* be, const char* bridge, const char* vif)
+{
+    return bridge_rem_if(bridge, vif);
+}
+
+static int bridge_set_up(struct vif_backend* be, const char* vif)
+{
+    return iface_set_up(vif);
+}
+
+static int bridge_set_down(struct vif_backend* be, const char* vif)
+{
+    return iface_set_down(vif);
+}
+
+struct vif_backend vif_backend_bridge = {
+    .name = "bridge",
+    .attach = bridge_attach,
+    .detach = bridge_detach,
+    .set_up = bridge_set_up,
+    .set_down = bridge_set_down,
+};
+
+
+int vif_backend_map(const char* pattern, struct vif_backend* be)
+{
+    if (nr_mappings == VIF_BACKEND_MAX) {
+        return ENOSPC;
+    }
+
+    mappings[nr_mappings].pattern = pattern;
+    mappings[nr_mappings].be = be;
+    nr_mappings++;
+
+    return 0;
+}
+
+struct vif_backend* vif_backend_for(const char* bridge)
+{
+    unsigned int i;
+
+    for (i = 0; i < nr_mappings; i++) {
+        if (fnmatch(mappings[i].pattern, bridge, 0) == 0) {
+            return mappings[i].be;
+        }
+    }
+
+    return &vif_backend_bridge;
+}
@@ -0,0 +1,243 @@
+/*
+ * xendevd
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *
+ *
+ * Copyright (c) 2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <xdd/aimd.h>
+#include <xdd/iface.h>
+#include <xdd/probe.h>
+#include <xdd/rtnl.h>
+#include <xdd/vif_route.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <net/if.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+#define VIF_ROUTE_SCRIPT    "vif-route"
+#define VIF_ROUTE_SEP       " ,"
+
+
+/* rtnetlink can't set IPv6 devconf entries, so this goes through sysctl */
+static int set_proxy_ndp(const char* dev, int on)
+{
+    int fd;
+    int err = 0;
+    char path[64 + IFNAMSIZ];
+
+    snprintf(path, sizeof(path), "/proc/sys/net/ipv6/conf/%s/proxy_ndp", dev);
+
+    fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return errno == ENOENT ? ENODEV : errno;
+    }
+
+    if (write(fd, on ? "1" : "0", 1) < 0) {
+        err = errno;
+    }
+
+    close(fd);
+
+    return err;
+}
+
+/* Next address of the list, without any prefix length */
+static char* next_addr(char* list, char** save)
+{
+    char* addr;
+    char* prefix;
+
+    addr = strtok_r(list, VIF_ROUTE_SEP, save);
+    if (addr == NULL) {
+        return NULL;
+    }
+
+    prefix = strchr(addr, '/');
+    if (prefix) {
+        *prefix = '\0';
+    }
+
+    return addr;
+}
+
+static int is_ipv6(const char* addr)
+{
+    return strchr(addr, ':') != NULL;
+}
+
+
+int vif_route_selected(const char* script)
+{
+    const char* base = strrchr(script, '/');
+
+    return strcmp(base ? base + 1 : script, VIF_ROUTE_SCRIPT) == 0;
+}
+
+int vif_route_online(const char* vif, const char* ips, const char* gatewaydev)
+{
+    int err;
+    int ipv6 = 0;
+    char* list;
+    char* addr;
+    char* save;
+    uint64_t start;
+    struct rtnl* nl;
+
+    /* routes through a link that is down are refused */
+    err = iface_set_up(vif);
+    if (err) {
+        return err;
+    }
+
+    list = strdup(ips);
+    if (list == NULL) {
+        return ENOMEM;
+    }
+
+    nl = rtnl_open();
+    if (nl == NULL) {
+        err = errno;
+        free(list);
+        return err;
+    }
+
+    start = aimd_enter(AIMD_RTNL);
+
+    err = rtnl_link_proxy_arp(nl, vif, 1);
+    if (err) {
+        goto out;
+    }
+
+    for (addr = next_addr(list, &save); addr; addr = next_addr(NULL, &save)) {
+        err = rtnl_route_add(nl, vif, addr);
+        XDD_PROBE3(vif_route_add, vif, addr, err);
+        if (err) {
+            goto out;
+        }
+
+        if (!is_ipv6(addr)) {
+            continue;
+        }
+        ipv6 = 1;
+
+        if (gatewaydev) {
+            err = rtnl_neigh_proxy_add(nl, gatewaydev, addr);
+            if (err) {
+                goto out;
+            }
+        }
+    }
+
+    if (ipv6) {
+        err = set_proxy_ndp(vif, 1);
+        if (err == 0 && gatewaydev) {
+            err = set_proxy_ndp(gatewaydev, 1);
+        }
+    }
+
+out:
+    aimd_exit(AIMD_RTNL, start);
+
+    rtnl_close(nl);
+    free(list);
+
+    return err;
+}
+
+/*
+ * Usually the vif is gone by now, taking its routes and settings along,
+ * so missing entries are not errors. Proxy entries on gatewaydev stay
+ * behind otherwise.
+ */
+int vif_route_offline(const char* vif, const char* ips, const char* gatewaydev)
+{
+    int err = 0;
+    int ret;
+    char* list;
+    char* addr;
+    char* save;
+    uint64_t start;
+    struct rtnl* nl;
+
+    list = strdup(ips);
+    if (list == NULL) {
+        return ENOMEM;
+    }
+
+    nl = rtnl_open();
+    if (nl == NULL) {
+        err = errno;
+        free(list);
+        return err;
+    }
+
+    start = aimd_enter(AIMD_RTNL);
+
+    for (addr = next_addr(list, &save); addr; addr = next_addr(NULL, &save)) {
+        ret = rtnl_route_del(nl, vif, addr);
+        XDD_PROBE3(vif_route_del, vif, addr, ret);
+        if (ret && ret != ESRCH && ret != ENODEV && err == 0) {
+            err = ret;
+        }
+
+        if (!is_ipv6(addr) || gatewaydev == NULL) {
+            continue;
+        }
+
+        ret = rtnl_neigh_proxy_del(nl, gatewaydev, addr);
+        if (ret && ret != ENOENT && ret != ENODEV && err == 0) {
+            err = ret;
+        }
+    }
+
+    ret = rtnl_link_proxy_arp(nl, vif, 0);
+    if (ret && ret != ENODEV && err == 0) {
+        err = ret;
+    }
+
+    aimd_exit(AIMD_RTNL, start);
+
+    rtnl_close(nl);
+    free(list);
+
+    ret = iface_set_down(vif);
+    if (ret && ret != ENODEV && err == 0) {
+        err = ret;
+    }
+
+    return err;
+}
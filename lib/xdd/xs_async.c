@@ -0,0 +1,405 @@
+/*
+ * xendevd
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *
+ *
+ * Copyright (c) 2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <xdd/xs_async.h>
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <xenstore.h>
+#include <xen/io/xs_wire.h>
+
+
+#define XS_ASYNC_BUCKETS    256
+
+struct xs_async_req {
+    uint32_t req_id;
+    xs_async_cb cb;
+    void* arg;
+
+    struct xs_async_req* next;
+};
+
+struct xs_async {
+    int fd;
+
+    uint32_t next_req_id;
+    unsigned int pending;
+    struct xs_async_req* reqs[XS_ASYNC_BUCKETS];
+
+    char* out;
+    size_t out_len;
+    size_t out_cap;
+
+    char in[sizeof(struct xsd_sockmsg) + XENSTORE_PAYLOAD_MAX + 1];
+    size_t in_len;
+};
+
+
+static int xs_errno(const char* errstring)
+{
+    unsigned int i;
+
+    for (i = 0; i < sizeof(xsd_errors) / sizeof(xsd_errors[0]); i++) {
+        if (strcmp(errstring, xsd_errors[i].errstring) == 0) {
+            return xsd_errors[i].errnum;
+        }
+    }
+
+    return EIO;
+}
+
+static struct xs_async_req* take_req(struct xs_async* xa, uint32_t req_id)
+{
+    struct xs_async_req* req;
+    struct xs_async_req** r = &xa->reqs[req_id % XS_ASYNC_BUCKETS];
+
+    while (*r && (*r)->req_id != req_id) {
+        r = &(*r)->next;
+    }
+
+    req = *r;
+    if (req) {
+        *r = req->next;
+        xa->pending--;
+    }
+
+    return req;
+}
+
+static int flush_out(struct xs_async* xa)
+{
+    ssize_t n;
+    size_t off = 0;
+
+    while (off < xa->out_len) {
+        n = write(xa->fd, xa->out + off, xa->out_len - off);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN) {
+                break;
+            }
+            return errno;
+        }
+        off += n;
+    }
+
+    memmove(xa->out, xa->out + off, xa->out_len - off);
+    xa->out_len -= off;
+
+    return 0;
+}
+
+static int send_msg(struct xs_async* xa, enum xsd_sockmsg_type type,
+        const char* p1, size_t l1, const char* p2, size_t l2,
+        xs_async_cb cb, void* arg)
+{
+    char* out;
+    size_t cap;
+    struct xs_async_req* req;
+    struct xsd_sockmsg msg;
+
+    if (l1 + l2 > XENSTORE_PAYLOAD_MAX) {
+        return E2BIG;
+    }
+
+    cap = xa->out_cap ? xa->out_cap : 4096;
+    while (cap < xa->out_len + sizeof(msg) + l1 + l2) {
+        cap *= 2;
+    }
+    if (cap != xa->out_cap) {
+        out = realloc(xa->out, cap);
+        if (out == NULL) {
+            return ENOMEM;
+        }
+        xa->out = out;
+        xa->out_cap = cap;
+    }
+
+    req = malloc(sizeof(struct xs_async_req));
+    if (req == NULL) {
+        return ENOMEM;
+    }
+
+    msg.type = type;
+    msg.req_id = xa->next_req_id++;
+    msg.tx_id = XBT_NULL;
+    msg.len = l1 + l2;
+
+    memcpy(xa->out + xa->out_len, &msg, sizeof(msg));
+    memcpy(xa->out + xa->out_len + sizeof(msg), p1, l1);
+    memcpy(xa->out + xa->out_len + sizeof(msg) + l1, p2, l2);
+    xa->out_len += sizeof(msg) + l1 + l2;
+
+    req->req_id = msg.req_id;
+    req->cb = cb;
+    req->arg = arg;
+    req->next = xa->reqs[msg.req_id % XS_ASYNC_BUCKETS];
+    xa->reqs[msg.req_id % XS_ASYNC_BUCKETS] = req;
+    xa->pending++;
+
+    /* write errors are reported to the callbacks by xs_async_process() */
+    flush_out(xa);
+
+    return 0;
+}
+
+static void dispatch(struct xs_async* xa, struct xsd_sockmsg* msg, char* payload)
+{
+    struct xs_async_req* req;
+
+    /* No watches are registered on this connection */
+    if (msg->type == XS_WATCH_EVENT) {
+        return;
+    }
+
+    req = take_req(xa, msg->req_id);
+    if (req == NULL) {
+        return;
+    }
+
+    payload[msg->len] = '\0';
+
+    if (req->cb) {
+        if (msg->type == XS_ERROR) {
+            req->cb(req->arg, xs_errno(payload), NULL, 0);
+        } else {
+            req->cb(req->arg, 0, payload, msg->len);
+        }
+    }
+
+    free(req);
+}
+
+static void fail_all(struct xs_async* xa, int err)
+{
+    int i;
+    struct xs_async_req* req;
+
+    for (i = 0; i < XS_ASYNC_BUCKETS; i++) {
+        while (xa->reqs[i]) {
+            req = xa->reqs[i];
+            xa->reqs[i] = req->next;
+            xa->pending--;
+
+            if (req->cb) {
+                req->cb(req->arg, err, NULL, 0);
+            }
+            free(req);
+        }
+    }
+}
+
+
+struct xs_async* xs_async_open(void)
+{
+    struct xs_async* xa;
+    struct sockaddr_un addr;
+    const char* path = xs_daemon_socket();
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+
+    xa = calloc(1, sizeof(struct xs_async));
+    if (xa == NULL) {
+        return NULL;
+    }
+
+    xa->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (xa->fd < 0) {
+        goto out_err;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if (connect(xa->fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+        goto out_err;
+    }
+
+    if (fcntl(xa->fd, F_SETFL, fcntl(xa->fd, F_GETFL, 0) | O_NONBLOCK) < 0) {
+        goto out_err;
+    }
+
+    return xa;
+
+out_err:
+    if (xa->fd >= 0) {
+        close(xa->fd);
+    }
+    free(xa);
+
+    return NULL;
+}
+
+void xs_async_close(struct xs_async* xa)
+{
+    fail_all(xa, ECONNABORTED);
+
+    close(xa->fd);
+    free(xa->out);
+    free(xa);
+}
+
+int xs_async_fileno(struct xs_async* xa)
+{
+    return xa->fd;
+}
+
+short xs_async_events(struct xs_async* xa)
+{
+    return xa->out_len ? POLLIN | POLLOUT : POLLIN;
+}
+
+unsigned int xs_async_pending(struct xs_async* xa)
+{
+    return xa->pending;
+}
+
+int xs_async_process(struct xs_async* xa)
+{
+    int err;
+    char next;
+    ssize_t n;
+    size_t msg_len;
+    struct xsd_sockmsg msg;
+
+    err = flush_out(xa);
+    if (err) {
+        goto out_err;
+    }
+
+    while (1) {
+        n = read(xa->fd, xa->in + xa->in_len, sizeof(xa->in) - 1 - xa->in_len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN) {
+                break;
+            }
+            err = errno;
+            goto out_err;
+        }
+        if (n == 0) {
+            err = EPIPE;
+            goto out_err;
+        }
+        xa->in_len += n;
+
+        while (xa->in_len >= sizeof(msg)) {
+            memcpy(&msg, xa->in, sizeof(msg));
+            if (msg.len > XENSTORE_PAYLOAD_MAX) {
+                err = EIO;
+                goto out_err;
+            }
+
+            msg_len = sizeof(msg) + msg.len;
+            if (xa->in_len < msg_len) {
+                break;
+            }
+
+            /* the payload is NUL terminated in place, save the next byte */
+            next = xa->in[msg_len];
+            dispatch(xa, &msg, xa->in + sizeof(msg));
+            xa->in[msg_len] = next;
+
+            memmove(xa->in, xa->in + msg_len, xa->in_len - msg_len);
+            xa->in_len -= msg_len;
+        }
+    }
+
+    return 0;
+
+out_err:
+    fail_all(xa, err);
+    return err;
+}
+
+int xs_async_read(struct xs_async* xa, const char* path, xs_async_cb cb, void* arg)
+{
+    return send_msg(xa, XS_READ, path, strlen(path) + 1, NULL, 0, cb, arg);
+}
+
+int xs_async_write(struct xs_async* xa, const char* path, const char* value, xs_async_cb cb, void* arg)
+{
+    return send_msg(xa, XS_WRITE, path, strlen(path) + 1, value, strlen(value), cb, arg);
+}
+
+int xs_read_k_async(struct xs_async* xa, const char* base_path, const char* key, xs_async_cb cb, void* arg)
+{
+    int err;
+    char* path;
+
+    if (asprintf(&path, "%s/%s", base_path, key) < 0) {
+        return ENOMEM;
+    }
+
+    err = xs_async_read(xa, path, cb, arg);
+
+    free(path);
+
+    return err;
+}
+
+int xs_write_k_async(struct xs_async* xa, const char* value, const char* base_path, const char* key, xs_async_cb cb, void* arg)
+{
+    int err;
+    char* path;
+
+    if (asprintf(&path, "%s/%s", base_path, key) < 0) {
+        return ENOMEM;
+    }
+
+    err = xs_async_write(xa, path, value, cb, arg);
+
+    free(path);
+
+    return err;
+}
@@ -0,0 +1,512 @@
+/*
+ * xendevd
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *
+ *
+ * Copyright (c) 2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <xdd/xs_cache.h>
+#include <xdd/xs_helper.h>
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xenstore.h>
+
+
+#define XS_CACHE_BUCKETS    256
+#define XS_CACHE_TOKEN      "xdd-cache"
+
+/*
+ * A key is invalidated by marking it stale and giving it a new generation.
+ * Reads snapshot the generation before going to xenstore and only store
+ * their result if it is unchanged, so a watch event that arrives during
+ * the round trip is never overwritten by the value read before it. Keys
+ * being read for the first time have no value yet.
+ */
+struct xs_cache_key {
+    char* key;
+    char* value;
+    int stale;
+    unsigned int gen;
+
+    struct xs_cache_key* next;
+};
+
+struct xs_cache_entry {
+    char* path;
+    unsigned int depth;
+
+    struct xs_cache_key* keys;
+    struct xs_cache_entry* next;
+};
+
+struct xs_cache {
+    struct xs_handle* xs;
+    char* root;
+    size_t root_len;
+    int watched;
+
+    pthread_mutex_t lock;
+    unsigned int gen;
+    unsigned int max_depth;
+    struct xs_cache_entry* buckets[XS_CACHE_BUCKETS];
+};
+
+
+static unsigned int hash_path(const char* path, size_t len)
+{
+    unsigned int h = 5381;
+
+    while (len--) {
+        h = (h << 5) + h + (unsigned char) *path++;
+    }
+
+    return h % XS_CACHE_BUCKETS;
+}
+
+static unsigned int path_depth(const char* path)
+{
+    unsigned int depth = 1;
+
+    for (; *path; path++) {
+        depth += *path == '/';
+    }
+
+    return depth;
+}
+
+static struct xs_cache_entry** find_entry(struct xs_cache* cache, const char* path, size_t len)
+{
+    struct xs_cache_entry** e = &cache->buckets[hash_path(path, len)];
+
+    while (*e) {
+        if (strlen((*e)->path) == len && strncmp((*e)->path, path, len) == 0) {
+            break;
+        }
+        e = &(*e)->next;
+    }
+
+    return e;
+}
+
+static struct xs_cache_key* find_key(struct xs_cache_entry* entry, const char* key)
+{
+    struct xs_cache_key* k;
+
+    for (k = entry->keys; k; k = k->next) {
+        if (strcmp(k->key, key) == 0) {
+            break;
+        }
+    }
+
+    return k;
+}
+
+static void free_entry(struct xs_cache_entry* entry)
+{
+    struct xs_cache_key* k;
+
+    while (entry->keys) {
+        k = entry->keys;
+        entry->keys = k->next;
+
+        free(k->key);
+        free(k->value);
+        free(k);
+    }
+
+    free(entry->path);
+    free(entry);
+}
+
+
+struct xs_cache* xs_cache_new(struct xs_handle* xs, const char* root)
+{
+    struct xs_cache* cache;
+
+    cache = calloc(1, sizeof(struct xs_cache));
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    cache->root = strdup(root);
+    if (cache->root == NULL) {
+        free(cache);
+        return NULL;
+    }
+
+    cache->xs = xs;
+    cache->root_len = strlen(root);
+    pthread_mutex_init(&cache->lock, NULL);
+
+    /* Without the watch nothing could be invalidated, so nothing is cached */
+    cache->watched = xs && xs_watch(xs, root, XS_CACHE_TOKEN);
+
+    return cache;
+}
+
+static void flush(struct xs_cache* cache)
+{
+    int i;
+    struct xs_cache_entry* e;
+
+    for (i = 0; i < XS_CACHE_BUCKETS; i++) {
+        while (cache->buckets[i]) {
+            e = cache->buckets[i];
+            cache->buckets[i] = e->next;
+            free_entry(e);
+        }
+    }
+
+    cache->max_depth = 0;
+}
+
+void xs_cache_free(struct xs_cache* cache)
+{
+    flush(cache);
+
+    if (cache->watched) {
+        xs_unwatch(cache->xs, cache->root, XS_CACHE_TOKEN);
+    }
+    if (cache->xs) {
+        xs_close(cache->xs);
+    }
+
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->root);
+    free(cache);
+}
+
+/* Called with the lock held */
+static int cacheable(struct xs_cache* cache, const char* base_path)
+{
+    return cache->watched &&
+            strncmp(base_path, cache->root, cache->root_len) == 0 &&
+            base_path[cache->root_len] == '/';
+}
+
+/* Finds or creates the key, to be filled by a read */
+static struct xs_cache_key* get_key(struct xs_cache* cache, const char* base_path, const char* key)
+{
+    struct xs_cache_key* k;
+    struct xs_cache_entry** e;
+
+    e = find_entry(cache, base_path, strlen(base_path));
+    if (*e == NULL) {
+        *e = calloc(1, sizeof(struct xs_cache_entry));
+        if (*e == NULL) {
+            return NULL;
+        }
+
+        (*e)->path = strdup(base_path);
+        if ((*e)->path == NULL) {
+            free(*e);
+            *e = NULL;
+            return NULL;
+        }
+
+        (*e)->depth = path_depth(base_path);
+        if ((*e)->depth > cache->max_depth) {
+            cache->max_depth = (*e)->depth;
+        }
+    }
+
+    k = find_key(*e, key);
+    if (k == NULL) {
+        k = calloc(1, sizeof(struct xs_cache_key));
+        if (k == NULL) {
+            return NULL;
+        }
+
+        k->key = strdup(key);
+        if (k->key == NULL) {
+            free(k);
+            return NULL;
+        }
+
+        k->gen = ++cache->gen;
+        k->next = (*e)->keys;
+        (*e)->keys = k;
+    }
+
+    return k;
+}
+
+/* Looks the key up again after a round trip, it may have been forgotten */
+static struct xs_cache_key* lookup_key(struct xs_cache* cache, const char* base_path, const char* key)
+{
+    struct xs_cache_entry* entry;
+
+    entry = *find_entry(cache, base_path, strlen(base_path));
+
+    return entry ? find_key(entry, key) : NULL;
+}
+
+static void store(struct xs_cache_key* k, unsigned int gen, const char* value)
+{
+    char* copy;
+
+    if (k == NULL || k->gen != gen) {
+        return;
+    }
+
+    copy = strdup(value);
+    if (copy == NULL) {
+        return;
+    }
+
+    free(k->value);
+    k->value = copy;
+    k->stale = 0;
+}
+
+char* xs_cache_read_k(struct xs_cache* cache, struct xs_handle* xs, const char* base_path, const char* key)
+{
+    char* value = NULL;
+    unsigned int gen = 0;
+    struct xs_cache_key* k;
+
+    pthread_mutex_lock(&cache->lock);
+
+    if (!cacheable(cache, base_path)) {
+        pthread_mutex_unlock(&cache->lock);
+        return xs_read_k(xs, base_path, key);
+    }
+
+    k = get_key(cache, base_path, key);
+    if (k) {
+        if (k->value && !k->stale) {
+            value = strdup(k->value);
+        }
+        gen = k->gen;
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+
+    if (value) {
+        return value;
+    }
+
+    /* don't hold the lock over the round trip */
+    value = xs_read_k(xs, base_path, key);
+
+    pthread_mutex_lock(&cache->lock);
+
+    k = lookup_key(cache, base_path, key);
+    if (value) {
+        store(k, gen, value);
+    } else if (k && k->value) {
+        /* Node is gone, fall back to the last known value */
+        value = strdup(k->value);
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+
+    return value;
+}
+
+int xs_cache_want(struct xs_cache* cache, const char* base_path, const char* key, unsigned int* gen)
+{
+    int want = 1;
+    struct xs_cache_key* k;
+
+    *gen = 0;
+
+    pthread_mutex_lock(&cache->lock);
+
+    k = cacheable(cache, base_path) ? get_key(cache, base_path, key) : NULL;
+    if (k) {
+        want = k->value == NULL || k->stale;
+        *gen = k->gen;
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+
+    return want;
+}
+
+void xs_cache_store(struct xs_cache* cache, const char* base_path, const char* key,
+        const char* value, unsigned int gen)
+{
+    pthread_mutex_lock(&cache->lock);
+    store(lookup_key(cache, base_path, key), gen, value);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void xs_cache_forget(struct xs_cache* cache, const char* base_path)
+{
+    struct xs_cache_entry* entry;
+    struct xs_cache_entry** e;
+
+    pthread_mutex_lock(&cache->lock);
+
+    e = find_entry(cache, base_path, strlen(base_path));
+    entry = *e;
+    if (entry) {
+        *e = entry->next;
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+
+    if (entry) {
+        free_entry(entry);
+    }
+}
+
+int xs_cache_fileno(struct xs_cache* cache)
+{
+    return cache->xs ? xs_fileno(cache->xs) : -1;
+}
+
+int xs_cache_check(struct xs_cache* cache, int* reconnected)
+{
+    int watched;
+    struct xs_handle* xs = cache->xs;
+
+    *reconnected = 0;
+
+    if (xs && !xs_alive_k(xs)) {
+        /* the watch went with the connection, nothing cached can be trusted */
+        pthread_mutex_lock(&cache->lock);
+        cache->watched = 0;
+        flush(cache);
+        pthread_mutex_unlock(&cache->lock);
+
+        xs_close(xs);
+        xs = NULL;
+        cache->xs = NULL;
+    }
+
+    if (xs == NULL) {
+        xs = xs_open_k();
+        if (xs == NULL) {
+            return errno;
+        }
+        cache->xs = xs;
+        *reconnected = 1;
+    }
+
+    if (cache->watched) {
+        return 0;
+    }
+
+    watched = xs_watch(xs, cache->root, XS_CACHE_TOKEN);
+
+    pthread_mutex_lock(&cache->lock);
+    cache->watched = watched;
+    pthread_mutex_unlock(&cache->lock);
+
+    return watched ? 0 : errno;
+}
+
+static void invalidate_key(struct xs_cache* cache, struct xs_cache_key* k)
+{
+    k->stale = 1;
+    k->gen = ++cache->gen;
+}
+
+static void invalidate_entry(struct xs_cache* cache, struct xs_cache_entry* entry)
+{
+    struct xs_cache_key* k;
+
+    for (k = entry->keys; k; k = k->next) {
+        invalidate_key(cache, k);
+    }
+}
+
+static void invalidate(struct xs_cache* cache, const char* path)
+{
+    int i;
+    char* sep;
+    size_t len;
+    struct xs_cache_key* k;
+    struct xs_cache_entry* entry;
+
+    /* The backend node itself, e.g. removed */
+    entry = *find_entry(cache, path, strlen(path));
+    if (entry) {
+        invalidate_entry(cache, entry);
+        return;
+    }
+
+    /* A key below the backend node */
+    sep = strrchr(path, '/');
+    if (sep) {
+        entry = *find_entry(cache, path, sep - path);
+        if (entry) {
+            k = find_key(entry, sep + 1);
+            if (k) {
+                invalidate_key(cache, k);
+            }
+            return;
+        }
+    }
+
+    /* An ancestor of backend nodes, e.g. a whole domain removed */
+    if (path_depth(path) >= cache->max_depth) {
+        return;
+    }
+
+    len = strlen(path);
+    for (i = 0; i < XS_CACHE_BUCKETS; i++) {
+        for (entry = cache->buckets[i]; entry; entry = entry->next) {
+            if (strncmp(entry->path, path, len) == 0 && entry->path[len] == '/') {
+                invalidate_entry(cache, entry);
+            }
+        }
+    }
+}
+
+void xs_cache_handle_watch(struct xs_cache* cache)
+{
+    char** watch;
+
+    if (cache->xs == NULL) {
+        return;
+    }
+
+    watch = xs_check_watch(cache->xs);
+    while (watch) {
+        if (strcmp(watch[XS_WATCH_TOKEN], XS_CACHE_TOKEN) == 0) {
+            pthread_mutex_lock(&cache->lock);
+            invalidate(cache, watch[XS_WATCH_PATH]);
+            pthread_mutex_unlock(&cache->lock);
+        }
+        free(watch);
+
+        watch = xs_check_watch(cache->xs);
+    }
+}
@@ -33,27 +33,99 @@
  *
  */
 
+#include <xdd/aimd.h>
+#include <xdd/probe.h>
 #include <xdd/xs_helper.h>
 
 #define _GNU_SOURCE
 
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <xenstore.h>
 
 
+/* Attempts at a transaction that keeps conflicting */
+#define XS_TX_RETRIES   8
+
+struct xs_pool {
+    unsigned int size;
+    unsigned int used;
+    struct xs_handle** handles;
+
+    pthread_key_t slot;
+    pthread_mutex_t lock;
+};
+
+/* Set by xs_read_k/xs_write_k when the calling thread's connection broke */
+static __thread int conn_lost;
+
+static void check_conn(void)
+{
+    switch (errno) {
+        case EBADF:
+        case EPIPE:
+        case ECONNRESET:
+        case ENOTCONN:
+            conn_lost = 1;
+            break;
+    }
+}
+
+struct xs_handle* xs_open_k(void)
+{
+    /* Don't silently fall back to the real xenbus device */
+    if (getenv("XENSTORED_PATH")) {
+        return xs_open(XS_OPEN_SOCKETONLY);
+    }
+
+    return xs_open(0);
+}
+
+int xs_alive_k(struct xs_handle* xs)
+{
+    void* value;
+    unsigned int len;
+
+    value = xs_read(xs, XBT_NULL, "/", &len);
+    if (value) {
+        free(value);
+        return 1;
+    }
+
+    switch (errno) {
+        case EBADF:
+        case EPIPE:
+        case ECONNRESET:
+        case ENOTCONN:
+            return 0;
+    }
+
+    return 1;
+}
+
 char* xs_read_k(struct xs_handle* xs, const char* base_path, const char* key)
 {
     char* path;
     char* value;
     unsigned int len;
+    uint64_t start;
 
     if (asprintf(&path, "%s/%s", base_path, key) < 0) {
         return NULL;
     }
 
+    start = aimd_enter(AIMD_XENSTORE);
     value = (char*) xs_read(xs, XBT_NULL, path, &len);
+    if (value == NULL) {
+        check_conn();
+    }
+    aimd_exit(AIMD_XENSTORE, start);
+
+    XDD_PROBE2(xs_read, path, value ? 0 : errno);
 
     free(path);
 
@@ -64,14 +136,213 @@ int xs_write_k(struct xs_handle* xs, const char* value, const char* base_path, c
 {
     bool ret;
     char* path;
+    uint64_t start;
 
     if (asprintf(&path, "%s/%s", base_path, key) < 0) {
         return -1;
     }
 
+    start = aimd_enter(AIMD_XENSTORE);
     ret = xs_write(xs, XBT_NULL, path, value, strlen(value));
+    if (!ret) {
+        check_conn();
+    }
+    aimd_exit(AIMD_XENSTORE, start);
+
+    XDD_PROBE3(xs_write, path, value, ret ? 0 : errno);
 
     free(path);
 
     return ret ? 0 : -1;
 }
+
+int xs_rm_keys_k(struct xs_handle* xs, char** base_paths, unsigned int n, const char** keys)
+{
+    int err = 0;
+    int attempt;
+    char* path;
+    unsigned int i;
+    const char** key;
+    uint64_t start;
+    xs_transaction_t t;
+
+    start = aimd_enter(AIMD_XENSTORE);
+
+    /* retried while the transaction conflicts with other writers */
+    for (attempt = 0; attempt < XS_TX_RETRIES; attempt++) {
+        t = xs_transaction_start(xs);
+        if (t == XBT_NULL) {
+            err = errno;
+            break;
+        }
+
+        for (i = 0; i < n && err == 0; i++) {
+            for (key = keys; *key && err == 0; key++) {
+                if (asprintf(&path, "%s/%s", base_paths[i], *key) < 0) {
+                    err = ENOMEM;
+                    break;
+                }
+
+                if (!xs_rm(xs, t, path) && errno != ENOENT) {
+                    err = errno;
+                }
+
+                free(path);
+            }
+        }
+
+        if (err) {
+            xs_transaction_end(xs, t, true);
+            break;
+        }
+
+        if (xs_transaction_end(xs, t, false)) {
+            break;
+        }
+
+        err = errno;
+        if (err != EAGAIN) {
+            break;
+        }
+        err = 0;
+    }
+
+    if (attempt == XS_TX_RETRIES) {
+        err = EAGAIN;
+    }
+
+    if (err) {
+        errno = err;
+        check_conn();
+    }
+    aimd_exit(AIMD_XENSTORE, start);
+
+    XDD_PROBE2(xs_rm_keys, n, err);
+
+    if (err) {
+        errno = err;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+struct xs_pool* xs_pool_new(unsigned int size)
+{
+    struct xs_pool* pool;
+
+    pool = calloc(1, sizeof(struct xs_pool));
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    pool->size = size;
+    pool->handles = calloc(size, sizeof(struct xs_handle*));
+    if (pool->handles == NULL) {
+        free(pool);
+        return NULL;
+    }
+
+    pthread_key_create(&pool->slot, NULL);
+    pthread_mutex_init(&pool->lock, NULL);
+
+    return pool;
+}
+
+void xs_pool_free(struct xs_pool* pool)
+{
+    unsigned int i;
+
+    for (i = 0; i < pool->size; i++) {
+        if (pool->handles[i]) {
+            xs_close(pool->handles[i]);
+        }
+    }
+
+    pthread_key_delete(pool->slot);
+    pthread_mutex_destroy(&pool->lock);
+
+    free(pool->handles);
+    free(pool);
+}
+
+struct xs_handle* xs_pool_get(struct xs_pool* pool)
+{
+    uintptr_t slot;
+    struct xs_handle** xs;
+
+    /* slots are numbered from 1 so that NULL means unassigned */
+    slot = (uintptr_t) pthread_getspecific(pool->slot);
+    if (slot == 0) {
+        pthread_mutex_lock(&pool->lock);
+        if (pool->used < pool->size) {
+            slot = ++pool->used;
+        }
+        pthread_mutex_unlock(&pool->lock);
+
+        if (slot == 0) {
+            errno = EMFILE;
+            return NULL;
+        }
+
+        pthread_setspecific(pool->slot, (void*) slot);
+    }
+
+    xs = &pool->handles[slot - 1];
+
+    /* xenstored went away (e.g. restarted), start over */
+    if (*xs && conn_lost) {
+        xs_close(*xs);
+        *xs = NULL;
+    }
+
+    if (*xs == NULL) {
+        *xs = xs_open_k();
+        conn_lost = 0;
+    }
+
+    return *xs;
+}
+
+char* xs_pool_read_k(struct xs_pool* pool, const char* base_path, const char* key)
+{
+    int retry;
+    char* value = NULL;
+    struct xs_handle* xs;
+
+    for (retry = 0; retry < 2; retry++) {
+        xs = xs_pool_get(pool);
+        if (xs == NULL) {
+            break;
+        }
+
+        value = xs_read_k(xs, base_path, key);
+        if (value || !conn_lost) {
+            break;
+        }
+    }
+
+    return value;
+}
+
+int xs_pool_write_k(struct xs_pool* pool, const char* value, const char* base_path, const char* key)
+{
+    int ret = -1;
+    int retry;
+    struct xs_handle* xs;
+
+    for (retry = 0; retry < 2; retry++) {
+        xs = xs_pool_get(pool);
+        if (xs == NULL) {
+            break;
+        }
+
+        ret = xs_write_k(xs, value, base_path, key);
+        if (ret == 0 || !conn_lost) {
+            break;
+        }
+    }
+
+    return ret;
+}
@@ -3,6 +3,9 @@ CLINK		 = $(CC) $(CFLAGS) $(1) $(LDFLAGS) -o $(2)
 CXXCOMPILE	 = $(CXX) $(CXXFLAGS) -c $(1) -o $(2)
 CXXLINK		 = $(CXX) $(CXXFLAGS) $(1) $(LDFLAGS) -o $(2)
 
+# y if the compiler finds header $(1), n otherwise
+have_header	 = $(shell $(CC) $(CFLAGS) -E -include $(1) -x c /dev/null >/dev/null 2>&1 && echo y || echo n)
+
 ifneq ($(verbose),y)
 ccompile	 = @printf " %-4s %s\n" "CC"  $@ && $(CCOMPILE)
 clink		 = @printf " %-4s %s\n" "LD"  $@ && $(CLINK)
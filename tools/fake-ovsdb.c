@@ -0,0 +1,1001 @@
+/*
+ * xendevd
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *
+ *
+ * Copyright (c) 2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * fake-ovsdb: a small in-memory stand-in for ovsdb-server.
+ *
+ * Speaks enough OVSDB JSON-RPC (RFC 7047) on a unix socket for the OVS vif
+ * backend: "transact" with insert, select and mutate on the Bridge, Port
+ * and Interface tables, and "echo". Transactions are atomic, names are
+ * unique per table, checked at commit, and Port and Interface rows no
+ * longer referenced are dropped, as with the real schema. Counts are
+ * printed on exit.
+ */
+
+#define _GNU_SOURCE
+
+#include <xdd/json.h>
+
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+
+#define MAX_CONNS       1024
+#define MAX_BRIDGES     64
+#define MAX_NAMED       4096
+
+enum table {
+    TABLE_BRIDGE    ,
+    TABLE_PORT      ,
+    TABLE_INTERFACE ,
+    NR_TABLES       ,
+};
+
+static const char* table_names[NR_TABLES] = { "Bridge", "Port", "Interface" };
+
+/* the column holding references, ports of a Bridge or interfaces of a Port */
+static const char* ref_columns[NR_TABLES] = { "ports", "interfaces", NULL };
+
+struct row {
+    char uuid[37];
+    char* name;
+
+    char** refs;
+    unsigned int nr_refs;
+
+    struct row* next;
+};
+
+struct db {
+    struct row* tables[NR_TABLES];
+};
+
+struct named {
+    const char* name;
+    const char* uuid;
+};
+
+struct conn {
+    int fd;
+
+    char* in;
+    size_t in_len;
+    size_t in_size;
+
+    char* out;
+    size_t out_len;
+
+    int echo_pending;
+};
+
+struct fovs_conf {
+    int help;
+    char* socket;
+    char* bridges[MAX_BRIDGES];
+    unsigned int nr_bridges;
+    unsigned long latency;
+    unsigned long echo;
+};
+
+static struct db db;
+static unsigned long next_uuid = 1;
+
+static unsigned long transactions;
+static unsigned long operations;
+static unsigned long aborted;
+
+static struct conn* conns[MAX_CONNS];
+static struct fovs_conf conf;
+
+static volatile sig_atomic_t stop_requested;
+
+
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void on_stop(int sig)
+{
+    stop_requested = 1;
+}
+
+
+/* database */
+
+static struct row* row_new(struct db* d, enum table t, const char* name)
+{
+    struct row* r;
+
+    r = calloc(1, sizeof(struct row));
+    r->name = strdup(name);
+    snprintf(r->uuid, sizeof(r->uuid), "%08lx-0000-4000-8000-%012lx", next_uuid >> 48, next_uuid);
+    next_uuid++;
+
+    r->next = d->tables[t];
+    d->tables[t] = r;
+
+    return r;
+}
+
+static void row_free(struct row* r)
+{
+    unsigned int i;
+
+    for (i = 0; i < r->nr_refs; i++) {
+        free(r->refs[i]);
+    }
+
+    free(r->refs);
+    free(r->name);
+    free(r);
+}
+
+static void db_free(struct db* d)
+{
+    int t;
+    struct row* r;
+
+    for (t = 0; t < NR_TABLES; t++) {
+        while (d->tables[t]) {
+            r = d->tables[t];
+            d->tables[t] = r->next;
+            row_free(r);
+        }
+    }
+}
+
+static void db_copy(struct db* dst, const struct db* src)
+{
+    int t;
+    unsigned int i;
+    struct row* r;
+    struct row* c;
+    struct row** link;
+
+    for (t = 0; t < NR_TABLES; t++) {
+        link = &dst->tables[t];
+
+        for (r = src->tables[t]; r; r = r->next) {
+            c = calloc(1, sizeof(struct row));
+            memcpy(c->uuid, r->uuid, sizeof(c->uuid));
+            c->name = strdup(r->name);
+            c->nr_refs = r->nr_refs;
+            c->refs = calloc(r->nr_refs ? r->nr_refs : 1, sizeof(char*));
+            for (i = 0; i < r->nr_refs; i++) {
+                c->refs[i] = strdup(r->refs[i]);
+            }
+
+            *link = c;
+            link = &c->next;
+        }
+
+        *link = NULL;
+    }
+}
+
+static struct row* row_by_uuid(struct db* d, enum table t, const char* uuid)
+{
+    struct row* r;
+
+    for (r = d->tables[t]; r; r = r->next) {
+        if (strcmp(r->uuid, uuid) == 0) {
+            return r;
+        }
+    }
+
+    return NULL;
+}
+
+static int row_has_ref(struct row* r, const char* uuid)
+{
+    unsigned int i;
+
+    for (i = 0; i < r->nr_refs; i++) {
+        if (strcmp(r->refs[i], uuid) == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int row_add_ref(struct row* r, const char* uuid)
+{
+    if (row_has_ref(r, uuid)) {
+        return 0;
+    }
+
+    r->refs = realloc(r->refs, (r->nr_refs + 1) * sizeof(char*));
+    r->refs[r->nr_refs++] = strdup(uuid);
+
+    return 1;
+}
+
+static int row_del_ref(struct row* r, const char* uuid)
+{
+    unsigned int i;
+
+    for (i = 0; i < r->nr_refs; i++) {
+        if (strcmp(r->refs[i], uuid) == 0) {
+            free(r->refs[i]);
+            r->refs[i] = r->refs[--r->nr_refs];
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* Drops rows of table t that no row of the referencing table points to */
+static void db_gc(struct db* d, enum table t)
+{
+    int used;
+    struct row* r;
+    struct row* ref;
+    struct row** link = &d->tables[t];
+
+    while ((r = *link)) {
+        used = 0;
+        for (ref = d->tables[t - 1]; ref && !used; ref = ref->next) {
+            used = row_has_ref(ref, r->uuid);
+        }
+
+        if (used) {
+            link = &r->next;
+        } else {
+            *link = r->next;
+            row_free(r);
+        }
+    }
+}
+
+/* Whether every reference points to an existing row */
+static int db_consistent(struct db* d)
+{
+    int t;
+    unsigned int i;
+    struct row* r;
+
+    for (t = 0; t < NR_TABLES - 1; t++) {
+        for (r = d->tables[t]; r; r = r->next) {
+            for (i = 0; i < r->nr_refs; i++) {
+                if (row_by_uuid(d, t + 1, r->refs[i]) == NULL) {
+                    return 0;
+                }
+            }
+        }
+    }
+
+    return 1;
+}
+
+/* NULL if names are unique in every table, otherwise the duplicate */
+static const char* db_duplicate(struct db* d)
+{
+    int t;
+    struct row* r;
+    struct row* o;
+
+    for (t = 0; t < NR_TABLES; t++) {
+        for (r = d->tables[t]; r; r = r->next) {
+            for (o = r->next; o; o = o->next) {
+                if (strcmp(r->name, o->name) == 0) {
+                    return r->name;
+                }
+            }
+        }
+    }
+
+    return NULL;
+}
+
+
+/* transactions */
+
+struct tx {
+    struct db db;
+    struct named named[MAX_NAMED];
+    unsigned int nr_named;
+    struct json_buf* out;
+};
+
+static int table_of(const struct json* op)
+{
+    int t;
+    const char* name = json_string(json_get(op, "table"));
+
+    for (t = 0; name && t < NR_TABLES; t++) {
+        if (strcmp(name, table_names[t]) == 0) {
+            return t;
+        }
+    }
+
+    return -1;
+}
+
+/* Resolves ["uuid", u] or ["named-uuid", n] */
+static const char* resolve(struct tx* tx, const struct json* v)
+{
+    unsigned int i;
+    const char* tag = json_string(json_index(v, 0));
+    const char* id = json_string(json_index(v, 1));
+
+    if (tag == NULL || id == NULL) {
+        return NULL;
+    }
+    if (strcmp(tag, "uuid") == 0) {
+        return id;
+    }
+    if (strcmp(tag, "named-uuid") != 0) {
+        return NULL;
+    }
+
+    for (i = 0; i < tx->nr_named; i++) {
+        if (strcmp(tx->named[i].name, id) == 0) {
+            return tx->named[i].uuid;
+        }
+    }
+
+    return NULL;
+}
+
+/* Calls fn for every uuid in a set or single atom, returns -1 on bad values */
+static int for_each_ref(struct tx* tx, const struct json* v, struct row* r,
+        int (*fn)(struct row* r, const char* uuid))
+{
+    int n = 0;
+    const char* uuid;
+    const char* tag = json_string(json_index(v, 0));
+    struct json* item;
+
+    if (tag && strcmp(tag, "set") == 0) {
+        for (item = json_index(v, 1) ? json_index(v, 1)->child : NULL; item; item = item->next) {
+            uuid = resolve(tx, item);
+            if (uuid == NULL) {
+                return -1;
+            }
+            n += fn(r, uuid);
+        }
+        return n;
+    }
+
+    uuid = resolve(tx, v);
+    if (uuid == NULL) {
+        return -1;
+    }
+
+    return fn(r, uuid);
+}
+
+/*
+ * Rows matching where, only ["name", "==", x] and, on the reference column,
+ * [column, "includes", ["uuid", x]] conditions are understood
+ */
+static int match(const struct json* where, int t, struct row* r)
+{
+    struct json* cond;
+    const char* column;
+    const char* fn;
+    const char* value;
+
+    for (cond = where ? where->child : NULL; cond; cond = cond->next) {
+        column = json_string(json_index(cond, 0));
+        fn = json_string(json_index(cond, 1));
+
+        if (column && fn && ref_columns[t] && strcmp(column, ref_columns[t]) == 0 &&
+                strcmp(fn, "includes") == 0) {
+            value = json_string(json_index(json_index(cond, 2), 1));
+            if (value == NULL || !row_has_ref(r, value)) {
+                return 0;
+            }
+            continue;
+        }
+
+        value = json_string(json_index(cond, 2));
+        if (column == NULL || fn == NULL || value == NULL ||
+                strcmp(column, "name") || strcmp(fn, "==") || strcmp(value, r->name)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static void error_result(struct tx* tx, const char* error, const char* details)
+{
+    json_buf_printf(tx->out, "{\"error\":");
+    json_buf_string(tx->out, error);
+    json_buf_printf(tx->out, ",\"details\":");
+    json_buf_string(tx->out, details);
+    json_buf_printf(tx->out, "}");
+}
+
+static int op_insert(struct tx* tx, int t, const struct json* op)
+{
+    const char* name;
+    const char* uuid_name;
+    struct json* row = json_get(op, "row");
+    struct json* refs;
+    struct row* r;
+
+    name = json_string(json_get(row, "name"));
+    if (name == NULL) {
+        error_result(tx, "constraint violation", "name is required");
+        return -1;
+    }
+
+    r = row_new(&tx->db, t, name);
+
+    refs = ref_columns[t] ? json_get(row, ref_columns[t]) : NULL;
+    if (refs && for_each_ref(tx, refs, r, row_add_ref) < 0) {
+        error_result(tx, "syntax error", "bad reference");
+        return -1;
+    }
+
+    uuid_name = json_string(json_get(op, "uuid-name"));
+    if (uuid_name) {
+        if (tx->nr_named == MAX_NAMED) {
+            error_result(tx, "resources exhausted", "too many named rows");
+            return -1;
+        }
+        tx->named[tx->nr_named].name = uuid_name;
+        tx->named[tx->nr_named].uuid = r->uuid;
+        tx->nr_named++;
+    }
+
+    json_buf_printf(tx->out, "{\"uuid\":[\"uuid\",\"%s\"]}", r->uuid);
+
+    return 0;
+}
+
+static int op_select(struct tx* tx, int t, const struct json* op)
+{
+    int first = 1;
+    unsigned int i;
+    struct row* r;
+
+    json_buf_printf(tx->out, "{\"rows\":[");
+
+    for (r = tx->db.tables[t]; r; r = r->next) {
+        if (!match(json_get(op, "where"), t, r)) {
+            continue;
+        }
+
+        json_buf_printf(tx->out, "%s{\"_uuid\":[\"uuid\",\"%s\"],\"name\":", first ? "" : ",", r->uuid);
+        json_buf_string(tx->out, r->name);
+
+        if (ref_columns[t]) {
+            json_buf_printf(tx->out, ",\"%s\":[\"set\",[", ref_columns[t]);
+            for (i = 0; i < r->nr_refs; i++) {
+                json_buf_printf(tx->out, "%s[\"uuid\",\"%s\"]", i ? "," : "", r->refs[i]);
+            }
+            json_buf_printf(tx->out, "]]");
+        }
+
+        json_buf_printf(tx->out, "}");
+        first = 0;
+    }
+
+    json_buf_printf(tx->out, "]}");
+
+    return 0;
+}
+
+static int op_mutate(struct tx* tx, int t, const struct json* op)
+{
+    int n;
+    int count = 0;
+    const char* column;
+    const char* mutator;
+    struct json* m;
+    struct row* r;
+
+    for (r = tx->db.tables[t]; r; r = r->next) {
+        if (!match(json_get(op, "where"), t, r)) {
+            continue;
+        }
+
+        for (m = json_get(op, "mutations") ? json_get(op, "mutations")->child : NULL; m; m = m->next) {
+            column = json_string(json_index(m, 0));
+            mutator = json_string(json_index(m, 1));
+
+            if (column == NULL || mutator == NULL || ref_columns[t] == NULL ||
+                    strcmp(column, ref_columns[t]) ||
+                    (strcmp(mutator, "insert") && strcmp(mutator, "delete"))) {
+                error_result(tx, "syntax error", "unsupported mutation");
+                return -1;
+            }
+
+            n = for_each_ref(tx, json_index(m, 2), r,
+                    strcmp(mutator, "insert") == 0 ? row_add_ref : row_del_ref);
+            if (n < 0) {
+                error_result(tx, "syntax error", "bad reference");
+                return -1;
+            }
+        }
+
+        count++;
+    }
+
+    json_buf_printf(tx->out, "{\"count\":%d}", count);
+
+    return 0;
+}
+
+static void transact(const struct json* params, struct json_buf* out)
+{
+    int t;
+    int err = 0;
+    unsigned int i;
+    const char* dup;
+    const char* name;
+    struct json* op;
+    struct tx* tx;
+
+    tx = calloc(1, sizeof(struct tx));
+    tx->out = out;
+    db_copy(&tx->db, &db);
+
+    json_buf_printf(out, "[");
+
+    for (op = params->child->next, i = 0; op; op = op->next, i++) {
+        if (i) {
+            json_buf_printf(out, ",");
+        }
+        if (err) {
+            json_buf_printf(out, "null");
+            continue;
+        }
+
+        operations++;
+
+        name = json_string(json_get(op, "op"));
+        t = table_of(op);
+
+        if (name == NULL || t < 0) {
+            error_result(tx, "syntax error", "unknown operation or table");
+            err = -1;
+        } else if (strcmp(name, "insert") == 0) {
+            err = op_insert(tx, t, op);
+        } else if (strcmp(name, "select") == 0) {
+            err = op_select(tx, t, op);
+        } else if (strcmp(name, "mutate") == 0) {
+            err = op_mutate(tx, t, op);
+        } else {
+            error_result(tx, "syntax error", "unsupported operation");
+            err = -1;
+        }
+    }
+
+    if (err == 0) {
+        db_gc(&tx->db, TABLE_PORT);
+        db_gc(&tx->db, TABLE_INTERFACE);
+
+        /* such violations are only found at commit, reported after the results */
+        dup = db_duplicate(&tx->db);
+        if (dup) {
+            json_buf_printf(out, "%s", i ? "," : "");
+            error_result(tx, "constraint violation", dup);
+            err = -1;
+        } else if (!db_consistent(&tx->db)) {
+            json_buf_printf(out, "%s", i ? "," : "");
+            error_result(tx, "referential integrity violation", "reference to a missing row");
+            err = -1;
+        }
+    }
+
+    json_buf_printf(out, "]");
+
+    transactions++;
+
+    if (err == 0) {
+        db_free(&db);
+        db = tx->db;
+    } else {
+        aborted++;
+        db_free(&tx->db);
+    }
+
+    free(tx);
+
+    if (conf.latency) {
+        usleep(conf.latency);
+    }
+}
+
+static void handle(struct conn* c, const struct json* msg)
+{
+    const char* method = json_string(json_get(msg, "method"));
+    const char* db_name;
+    struct json* params = json_get(msg, "params");
+    struct json* id = json_get(msg, "id");
+    struct json_buf out;
+
+    /* replies to our echoes, any traffic counts */
+    if (method == NULL) {
+        return;
+    }
+
+    if (id == NULL || params == NULL || params->type != JSON_ARRAY) {
+        return;
+    }
+
+    json_buf_init(&out);
+    json_buf_printf(&out, "{\"id\":");
+    json_buf_value(&out, id);
+    json_buf_printf(&out, ",");
+
+    db_name = json_string(json_index(params, 0));
+
+    if (strcmp(method, "echo") == 0) {
+        json_buf_printf(&out, "\"result\":");
+        json_buf_value(&out, params);
+        json_buf_printf(&out, ",\"error\":null}");
+    } else if (strcmp(method, "transact") == 0 && db_name && strcmp(db_name, "Open_vSwitch") == 0) {
+        json_buf_printf(&out, "\"result\":");
+        transact(params, &out);
+        json_buf_printf(&out, ",\"error\":null}");
+    } else {
+        json_buf_printf(&out, "\"result\":null,\"error\":\"unknown method\"}");
+    }
+
+    c->out = realloc(c->out, c->out_len + out.len);
+    memcpy(c->out + c->out_len, out.data, out.len);
+    c->out_len += out.len;
+
+    json_buf_free(&out);
+}
+
+
+/* connections */
+
+static void conn_close(int i)
+{
+    struct conn* c = conns[i];
+
+    close(c->fd);
+
+    free(c->in);
+    free(c->out);
+    free(c);
+    conns[i] = NULL;
+}
+
+static void conn_accept(int lfd)
+{
+    int i;
+    int fd;
+    struct conn* c;
+
+    fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+
+    for (i = 0; i < MAX_CONNS && conns[i]; i++);
+    if (i == MAX_CONNS) {
+        close(fd);
+        return;
+    }
+
+    c = calloc(1, sizeof(struct conn));
+    c->fd = fd;
+    conns[i] = c;
+}
+
+static int conn_read(struct conn* c)
+{
+    ssize_t n;
+    size_t used;
+    struct json* msg;
+
+    if (c->in_len == c->in_size) {
+        c->in_size = c->in_size ? 2 * c->in_size : 65536;
+        c->in = realloc(c->in, c->in_size);
+    }
+
+    n = read(c->fd, c->in + c->in_len, c->in_size - c->in_len);
+    if (n <= 0) {
+        return n < 0 && errno == EAGAIN ? 0 : -1;
+    }
+    c->in_len += n;
+    c->echo_pending = 0;
+
+    while (c->in_len) {
+        msg = json_parse(c->in, c->in_len, &used);
+        if (msg == NULL) {
+            return errno == EAGAIN ? 0 : -1;
+        }
+
+        handle(c, msg);
+        json_free(msg);
+
+        memmove(c->in, c->in + used, c->in_len - used);
+        c->in_len -= used;
+    }
+
+    return 0;
+}
+
+static int conn_flush(struct conn* c)
+{
+    ssize_t n;
+
+    while (c->out_len) {
+        n = write(c->fd, c->out, c->out_len);
+        if (n < 0) {
+            return errno == EAGAIN ? 0 : -1;
+        }
+
+        memmove(c->out, c->out + n, c->out_len - n);
+        c->out_len -= n;
+    }
+
+    return 0;
+}
+
+/* Like ovsdb-server's inactivity probe, drops clients silent since the last probe */
+static int conn_echo(struct conn* c)
+{
+    static const char echo[] = "{\"method\":\"echo\",\"params\":[],\"id\":\"echo\"}";
+
+    if (c->echo_pending) {
+        return -1;
+    }
+
+    c->out = realloc(c->out, c->out_len + sizeof(echo) - 1);
+    memcpy(c->out + c->out_len, echo, sizeof(echo) - 1);
+    c->out_len += sizeof(echo) - 1;
+    c->echo_pending = 1;
+
+    return 0;
+}
+
+
+static int parse_args(int argc, char** argv)
+{
+    const char *short_opts = "hs:b:l:e:";
+    const struct option long_opts[] = {
+        { "help"               , no_argument       , NULL , 'h' },
+        { "socket"             , required_argument , NULL , 's' },
+        { "bridge"             , required_argument , NULL , 'b' },
+        { "latency"            , required_argument , NULL , 'l' },
+        { "echo"               , required_argument , NULL , 'e' },
+        { NULL , 0 , NULL , 0 }
+    };
+
+    int opt;
+    int opt_index;
+    int error = 0;
+
+    while (1) {
+        opt = getopt_long(argc, argv, short_opts, long_opts, &opt_index);
+
+        if (opt == -1) {
+            break;
+        }
+
+        switch (opt) {
+            case 'h':
+                conf.help = 1;
+                break;
+
+            case 's':
+                conf.socket = optarg;
+                break;
+
+            case 'b':
+                if (conf.nr_bridges == MAX_BRIDGES) {
+                    printf("%s: too many bridges\n", argv[0]);
+                    error = 1;
+                    break;
+                }
+                conf.bridges[conf.nr_bridges++] = optarg;
+                break;
+
+            case 'l':
+                conf.latency = strtoul(optarg, NULL, 0);
+                break;
+
+            case 'e':
+                conf.echo = strtoul(optarg, NULL, 0);
+                break;
+
+            default:
+                error = 1;
+                break;
+        }
+    }
+
+    while (optind < argc) {
+        error = 1;
+
+        printf("%s: invalid argument \'%s\'\n", argv[0], argv[optind]);
+        optind++;
+    }
+
+    return error;
+}
+
+static void print_usage(char* cmd)
+{
+    printf("Usage: %s [OPTION]...\n", cmd);
+    printf("\n");
+    printf("Options:\n");
+    printf("  -h, --help             Display this help and exit\n");
+    printf("  -s, --socket <path>    Listen on path [default: /var/run/openvswitch/db.sock]\n");
+    printf("  -b, --bridge <name>    Create bridge name, may be repeated\n");
+    printf("  -l, --latency <usec>   Take usec to commit every transaction\n");
+    printf("  -e, --echo <ms>        Probe clients every ms, dropping those that don't answer\n");
+}
+
+
+int main(int argc, char** argv)
+{
+    int i;
+    int lfd;
+    int err;
+    uint64_t next_echo = 0;
+    unsigned long ports = 0;
+    struct row* r;
+    struct sockaddr_un addr;
+    struct sigaction sa;
+
+    struct pollfd fds[MAX_CONNS + 1];
+    int idx[MAX_CONNS + 1];
+    nfds_t nfds;
+
+
+    /* Parse arguments */
+    conf.socket = "/var/run/openvswitch/db.sock";
+
+    err = parse_args(argc, argv);
+    if (err || conf.help) {
+        print_usage(argv[0]);
+        return err ? 1 : 0;
+    }
+
+    if (strlen(conf.socket) >= sizeof(addr.sun_path)) {
+        printf("Socket path too long.\n");
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    /* no SA_RESTART, so poll() returns and the counts get printed */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_stop;
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+
+    for (i = 0; i < conf.nr_bridges; i++) {
+        row_new(&db, TABLE_BRIDGE, conf.bridges[i]);
+    }
+
+
+    /* setup socket */
+    lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (lfd < 0) {
+        perror("socket");
+        return 1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, conf.socket);
+    unlink(conf.socket);
+
+    if (bind(lfd, (struct sockaddr*) &addr, sizeof(addr)) < 0 || listen(lfd, 128) < 0) {
+        perror(conf.socket);
+        return 1;
+    }
+
+
+    /* main loop */
+    while (!stop_requested) {
+        if (conf.echo && now_ms() >= next_echo) {
+            next_echo = now_ms() + conf.echo;
+
+            for (i = 0; i < MAX_CONNS; i++) {
+                if (conns[i] && conn_echo(conns[i])) {
+                    conn_close(i);
+                }
+            }
+        }
+
+        nfds = 1;
+
+        fds[0].fd = lfd;
+        fds[0].events = POLLIN;
+
+        for (i = 0; i < MAX_CONNS; i++) {
+            if (conns[i] == NULL) {
+                continue;
+            }
+
+            if (conn_flush(conns[i])) {
+                conn_close(i);
+                continue;
+            }
+
+            fds[nfds].fd = conns[i]->fd;
+            fds[nfds].events = conns[i]->out_len ? POLLIN | POLLOUT : POLLIN;
+            idx[nfds] = i;
+            nfds++;
+        }
+
+        if (poll(fds, nfds, conf.echo ? conf.echo : -1) < 0) {
+            continue;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            conn_accept(lfd);
+        }
+
+        for (i = 1; i < nfds; i++) {
+            if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                if (conn_read(conns[idx[i]])) {
+                    conn_close(idx[i]);
+                }
+            }
+        }
+    }
+
+    for (r = db.tables[TABLE_PORT]; r; r = r->next) {
+        ports++;
+    }
+
+    printf("{\"transactions\": %lu, \"aborted\": %lu, \"operations\": %lu, \"ports\": %lu}\n",
+            transactions, aborted, operations, ports);
+
+    unlink(conf.socket);
+
+    return 0;
+}
@@ -0,0 +1,950 @@
+/*
+ * xendevd
+ *
+ * Authors: Filipe Manco <filipe.manco@neclab.eu>
+ *
+ *
+ * Copyright (c) 2017, NEC Europe Ltd., NEC Corporation All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * fake-xenstored: a small in-memory xenstored for tests and benchmarks.
+ *
+ * Speaks the xenstore wire protocol on a unix socket, keeps the whole tree
+ * in memory and supports watches and (optimistic, whole-tree) transactions.
+ * Every reply can be delayed by a fixed latency plus random jitter to mimic
+ * a loaded xenstored. Clients find it through XENSTORED_PATH.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include <xen/io/xs_wire.h>
+
+
+#define MAX_CONNS   1024
+
+struct node {
+    char* name;
+    char* value;
+    unsigned int len;
+
+    struct node* children;
+    struct node* next;
+};
+
+struct change {
+    char* path;
+    int rm;
+
+    struct change* next;
+};
+
+struct tx {
+    uint32_t id;
+    unsigned long gen;
+    struct node* root;
+    struct change* changes;
+
+    struct tx* next;
+};
+
+struct watch {
+    char* path;
+    char* token;
+    int relative;
+
+    struct watch* next;
+};
+
+struct reply {
+    uint64_t due;
+    size_t len;
+    char* data;
+
+    struct reply* next;
+};
+
+struct conn {
+    int fd;
+
+    char in[sizeof(struct xsd_sockmsg) + XENSTORE_PAYLOAD_MAX + 1];
+    size_t in_len;
+
+    char* out;
+    size_t out_len;
+
+    struct reply* replies;
+    struct reply** replies_tail;
+    uint64_t last_due;
+
+    struct watch* watches;
+    struct tx* txs;
+};
+
+struct fxs_conf {
+    int help;
+    char* socket;
+    unsigned long latency;
+    unsigned long jitter;
+};
+
+static struct node* root;
+static unsigned long generation;
+static uint32_t next_tx_id = 1;
+
+static struct conn* conns[MAX_CONNS];
+static struct fxs_conf conf;
+
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+/* tree */
+
+static struct node* node_new(const char* name, size_t name_len)
+{
+    struct node* n = calloc(1, sizeof(struct node));
+
+    n->name = strndup(name, name_len);
+    n->value = strdup("");
+
+    return n;
+}
+
+static void node_free(struct node* n)
+{
+    struct node* c;
+
+    while (n->children) {
+        c = n->children;
+        n->children = c->next;
+        node_free(c);
+    }
+
+    free(n->name);
+    free(n->value);
+    free(n);
+}
+
+static struct node* node_copy(struct node* n)
+{
+    struct node* c;
+    struct node** tail;
+    struct node* copy = calloc(1, sizeof(struct node));
+
+    copy->name = strdup(n->name);
+    copy->value = malloc(n->len + 1);
+    memcpy(copy->value, n->value, n->len + 1);
+    copy->len = n->len;
+
+    tail = &copy->children;
+    for (c = n->children; c; c = c->next) {
+        *tail = node_copy(c);
+        tail = &(*tail)->next;
+    }
+
+    return copy;
+}
+
+/* Walks path from r; create makes missing nodes. Parent link returned in pp. */
+static struct node* node_lookup(struct node* r, const char* path, int create, struct node*** pp)
+{
+    size_t len;
+    const char* end;
+    struct node* n = r;
+    struct node** link = NULL;
+
+    while (*path == '/') {
+        path++;
+    }
+
+    while (*path) {
+        end = strchrnul(path, '/');
+        len = end - path;
+
+        link = &n->children;
+        while (*link && (strlen((*link)->name) != len || strncmp((*link)->name, path, len))) {
+            link = &(*link)->next;
+        }
+
+        if (*link == NULL) {
+            if (!create) {
+                return NULL;
+            }
+            *link = node_new(path, len);
+        }
+
+        n = *link;
+        path = end;
+        while (*path == '/') {
+            path++;
+        }
+    }
+
+    if (pp) {
+        *pp = link;
+    }
+
+    return n;
+}
+
+
+/* output */
+
+static void conn_queue(struct conn* c, uint32_t type, uint32_t req_id, uint32_t tx_id,
+        const char* payload, size_t len, int delay)
+{
+    struct reply* r = calloc(1, sizeof(struct reply));
+    struct xsd_sockmsg msg;
+    uint64_t due = now_us();
+
+    msg.type = type;
+    msg.req_id = req_id;
+    msg.tx_id = tx_id;
+    msg.len = len;
+
+    r->len = sizeof(msg) + len;
+    r->data = malloc(r->len);
+    memcpy(r->data, &msg, sizeof(msg));
+    memcpy(r->data + sizeof(msg), payload, len);
+
+    if (delay) {
+        due += conf.latency;
+        if (conf.jitter) {
+            due += random() % conf.jitter;
+        }
+    }
+
+    /* replies on a connection stay in order, as with the real daemon */
+    if (c->replies && due < c->last_due) {
+        due = c->last_due;
+    }
+    r->due = due;
+    c->last_due = due;
+
+    *c->replies_tail = r;
+    c->replies_tail = &r->next;
+}
+
+static void reply(struct conn* c, struct xsd_sockmsg* req, const char* payload, size_t len)
+{
+    conn_queue(c, req->type, req->req_id, req->tx_id, payload, len, 1);
+}
+
+static void reply_ok(struct conn* c, struct xsd_sockmsg* req)
+{
+    reply(c, req, "OK", 3);
+}
+
+static void reply_err(struct conn* c, struct xsd_sockmsg* req, int err)
+{
+    unsigned int i;
+    const char* s = "EINVAL";
+
+    for (i = 0; i < sizeof(xsd_errors) / sizeof(xsd_errors[0]); i++) {
+        if (xsd_errors[i].errnum == err) {
+            s = xsd_errors[i].errstring;
+            break;
+        }
+    }
+
+    conn_queue(c, XS_ERROR, req->req_id, req->tx_id, s, strlen(s) + 1, 1);
+}
+
+
+/* watches */
+
+static int is_child(const char* child, const char* parent)
+{
+    size_t len = strlen(parent);
+
+    if (strncmp(child, parent, len)) {
+        return 0;
+    }
+
+    return child[len] == '\0' || child[len] == '/' || strcmp(parent, "/") == 0;
+}
+
+static void watch_event(struct conn* c, struct watch* w, const char* path)
+{
+    char buf[XENSTORE_PAYLOAD_MAX];
+    size_t plen;
+    size_t tlen = strlen(w->token) + 1;
+
+    /* as xenstored, relative watches get relative paths */
+    if (w->relative && strncmp(path, "/local/domain/0/", 16) == 0) {
+        path += 16;
+    }
+    plen = strlen(path) + 1;
+
+    if (plen + tlen > sizeof(buf)) {
+        return;
+    }
+
+    memcpy(buf, path, plen);
+    memcpy(buf + plen, w->token, tlen);
+
+    conn_queue(c, XS_WATCH_EVENT, 0, 0, buf, plen + tlen, 1);
+}
+
+static void fire_watches(const char* path, int rm)
+{
+    int i;
+    struct watch* w;
+
+    for (i = 0; i < MAX_CONNS; i++) {
+        if (conns[i] == NULL) {
+            continue;
+        }
+
+        for (w = conns[i]->watches; w; w = w->next) {
+            if (is_child(path, w->path) || (rm && is_child(w->path, path))) {
+                watch_event(conns[i], w, rm && is_child(w->path, path) ? w->path : path);
+            }
+        }
+    }
+}
+
+
+/* requests */
+
+static char* canonical(const char* path)
+{
+    char* abs;
+
+    if (path[0] == '/' || path[0] == '@') {
+        return strdup(path);
+    }
+
+    if (asprintf(&abs, "/local/domain/0/%s", path) < 0) {
+        return NULL;
+    }
+
+    return abs;
+}
+
+static struct tx* find_tx(struct conn* c, uint32_t id)
+{
+    struct tx* t;
+
+    for (t = c->txs; t; t = t->next) {
+        if (t->id == id) {
+            break;
+        }
+    }
+
+    return t;
+}
+
+static void record_change(struct tx* t, const char* path, int rm)
+{
+    struct change* ch;
+
+    if (t == NULL) {
+        generation++;
+        fire_watches(path, rm);
+        return;
+    }
+
+    ch = calloc(1, sizeof(struct change));
+    ch->path = strdup(path);
+    ch->rm = rm;
+    ch->next = t->changes;
+    t->changes = ch;
+}
+
+static void free_tx(struct tx* t)
+{
+    struct change* ch;
+
+    while (t->changes) {
+        ch = t->changes;
+        t->changes = ch->next;
+        free(ch->path);
+        free(ch);
+    }
+
+    node_free(t->root);
+    free(t);
+}
+
+static void end_tx(struct conn* c, struct xsd_sockmsg* req, const char* arg)
+{
+    struct tx* t;
+    struct tx** link;
+    struct change* ch;
+    int commit = strcmp(arg, "T") == 0;
+
+    for (link = &c->txs; *link && (*link)->id != req->tx_id; link = &(*link)->next);
+
+    t = *link;
+    if (t == NULL) {
+        reply_err(c, req, ENOENT);
+        return;
+    }
+    *link = t->next;
+
+    if (commit && t->gen != generation) {
+        free_tx(t);
+        reply_err(c, req, EAGAIN);
+        return;
+    }
+
+    if (commit) {
+        node_free(root);
+        root = t->root;
+        t->root = node_new("", 0);
+
+        generation++;
+        for (ch = t->changes; ch; ch = ch->next) {
+            fire_watches(ch->path, ch->rm);
+        }
+    }
+
+    free_tx(t);
+    reply_ok(c, req);
+}
+
+static void handle(struct conn* c, struct xsd_sockmsg* req, char* payload)
+{
+    char* path;
+    char* value;
+    size_t plen;
+    char buf[XENSTORE_PAYLOAD_MAX];
+    size_t len;
+    struct node* n;
+    struct node** link;
+    struct tx* t = NULL;
+    struct watch* w;
+    struct watch** wl;
+    struct node* r = root;
+
+    payload[req->len] = '\0';
+
+    if (req->tx_id) {
+        t = find_tx(c, req->tx_id);
+        if (t == NULL) {
+            reply_err(c, req, ENOENT);
+            return;
+        }
+        r = t->root;
+    }
+
+    switch (req->type) {
+        case XS_READ:
+            path = canonical(payload);
+            n = node_lookup(r, path, 0, NULL);
+            if (n) {
+                reply(c, req, n->value, n->len);
+            } else {
+                reply_err(c, req, ENOENT);
+            }
+            free(path);
+            break;
+
+        case XS_WRITE:
+            plen = strnlen(payload, req->len);
+            if (plen == req->len) {
+                reply_err(c, req, EINVAL);
+                break;
+            }
+            path = canonical(payload);
+            n = node_lookup(r, path, 1, NULL);
+            len = req->len - plen - 1;
+            value = malloc(len + 1);
+            memcpy(value, payload + plen + 1, len);
+            value[len] = '\0';
+            free(n->value);
+            n->value = value;
+            n->len = len;
+            record_change(t, path, 0);
+            reply_ok(c, req);
+            free(path);
+            break;
+
+        case XS_MKDIR:
+            path = canonical(payload);
+            if (node_lookup(r, path, 0, NULL) == NULL) {
+                node_lookup(r, path, 1, NULL);
+                record_change(t, path, 0);
+            }
+            reply_ok(c, req);
+            free(path);
+            break;
+
+        case XS_RM:
+            path = canonical(payload);
+            n = node_lookup(r, path, 0, &link);
+            if (n && link) {
+                *link = n->next;
+                node_free(n);
+                record_change(t, path, 1);
+            }
+            reply_ok(c, req);
+            free(path);
+            break;
+
+        case XS_DIRECTORY:
+            path = canonical(payload);
+            n = node_lookup(r, path, 0, NULL);
+            free(path);
+            if (n == NULL) {
+                reply_err(c, req, ENOENT);
+                break;
+            }
+            len = 0;
+            for (n = n->children; n; n = n->next) {
+                plen = strlen(n->name) + 1;
+                if (len + plen > sizeof(buf)) {
+                    break;
+                }
+                memcpy(buf + len, n->name, plen);
+                len += plen;
+            }
+            reply(c, req, buf, len);
+            break;
+
+        case XS_GET_PERMS:
+            reply(c, req, "n0", 3);
+            break;
+
+        case XS_SET_PERMS:
+            reply_ok(c, req);
+            break;
+
+        case XS_WATCH:
+            plen = strnlen(payload, req->len);
+            if (plen == req->len) {
+                reply_err(c, req, EINVAL);
+                break;
+            }
+            w = calloc(1, sizeof(struct watch));
+            w->path = canonical(payload);
+            w->relative = payload[0] != '/' && payload[0] != '@';
+            w->token = strdup(payload + plen + 1);
+            w->next = c->watches;
+            c->watches = w;
+            reply_ok(c, req);
+            watch_event(c, w, w->path);
+            break;
+
+        case XS_UNWATCH:
+            plen = strnlen(payload, req->len);
+            path = canonical(payload);
+            for (wl = &c->watches; *wl; wl = &(*wl)->next) {
+                if (strcmp((*wl)->path, path) == 0 && plen < req->len &&
+                        strcmp((*wl)->token, payload + plen + 1) == 0) {
+                    break;
+                }
+            }
+            if (*wl) {
+                w = *wl;
+                *wl = w->next;
+                free(w->path);
+                free(w->token);
+                free(w);
+                reply_ok(c, req);
+            } else {
+                reply_err(c, req, ENOENT);
+            }
+            free(path);
+            break;
+
+        case XS_RESET_WATCHES:
+            while (c->watches) {
+                w = c->watches;
+                c->watches = w->next;
+                free(w->path);
+                free(w->token);
+                free(w);
+            }
+            reply_ok(c, req);
+            break;
+
+        case XS_TRANSACTION_START:
+            t = calloc(1, sizeof(struct tx));
+            t->id = next_tx_id++;
+            t->gen = generation;
+            t->root = node_copy(root);
+            t->next = c->txs;
+            c->txs = t;
+            len = snprintf(buf, sizeof(buf), "%u", t->id) + 1;
+            reply(c, req, buf, len);
+            break;
+
+        case XS_TRANSACTION_END:
+            end_tx(c, req, payload);
+            break;
+
+        case XS_GET_DOMAIN_PATH:
+            len = snprintf(buf, sizeof(buf), "/local/domain/%s", payload) + 1;
+            reply(c, req, buf, len);
+            break;
+
+        case XS_IS_DOMAIN_INTRODUCED:
+            reply(c, req, "T", 2);
+            break;
+
+        default:
+            reply_err(c, req, ENOSYS);
+            break;
+    }
+}
+
+
+/* connections */
+
+static void conn_close(int i)
+{
+    struct conn* c = conns[i];
+    struct watch* w;
+    struct tx* t;
+    struct reply* r;
+
+    close(c->fd);
+
+    while (c->watches) {
+        w = c->watches;
+        c->watches = w->next;
+        free(w->path);
+        free(w->token);
+        free(w);
+    }
+
+    while (c->txs) {
+        t = c->txs;
+        c->txs = t->next;
+        free_tx(t);
+    }
+
+    while (c->replies) {
+        r = c->replies;
+        c->replies = r->next;
+        free(r->data);
+        free(r);
+    }
+
+    free(c->out);
+    free(c);
+    conns[i] = NULL;
+}
+
+static void conn_accept(int lfd)
+{
+    int i;
+    int fd;
+    struct conn* c;
+
+    fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+
+    for (i = 0; i < MAX_CONNS && conns[i]; i++);
+    if (i == MAX_CONNS) {
+        close(fd);
+        return;
+    }
+
+    c = calloc(1, sizeof(struct conn));
+    c->fd = fd;
+    c->replies_tail = &c->replies;
+    conns[i] = c;
+}
+
+static int conn_read(struct conn* c)
+{
+    char next;
+    ssize_t n;
+    size_t msg_len;
+    struct xsd_sockmsg msg;
+
+    n = read(c->fd, c->in + c->in_len, sizeof(c->in) - 1 - c->in_len);
+    if (n <= 0) {
+        return n < 0 && errno == EAGAIN ? 0 : -1;
+    }
+    c->in_len += n;
+
+    while (c->in_len >= sizeof(msg)) {
+        memcpy(&msg, c->in, sizeof(msg));
+        if (msg.len > XENSTORE_PAYLOAD_MAX) {
+            return -1;
+        }
+
+        msg_len = sizeof(msg) + msg.len;
+        if (c->in_len < msg_len) {
+            break;
+        }
+
+        /* the payload is NUL terminated in place, save the next byte */
+        next = c->in[msg_len];
+        handle(c, &msg, c->in + sizeof(msg));
+        c->in[msg_len] = next;
+
+        memmove(c->in, c->in + msg_len, c->in_len - msg_len);
+        c->in_len -= msg_len;
+    }
+
+    return 0;
+}
+
+/* Moves due replies to the output buffer and writes what the socket takes */
+static int conn_flush(struct conn* c, uint64_t now)
+{
+    ssize_t n;
+    struct reply* r;
+
+    while (c->replies && c->replies->due <= now) {
+        r = c->replies;
+        c->replies = r->next;
+        if (c->replies == NULL) {
+            c->replies_tail = &c->replies;
+        }
+
+        c->out = realloc(c->out, c->out_len + r->len);
+        memcpy(c->out + c->out_len, r->data, r->len);
+        c->out_len += r->len;
+
+        free(r->data);
+        free(r);
+    }
+
+    while (c->out_len) {
+        n = write(c->fd, c->out, c->out_len);
+        if (n < 0) {
+            return errno == EAGAIN ? 0 : -1;
+        }
+
+        memmove(c->out, c->out + n, c->out_len - n);
+        c->out_len -= n;
+    }
+
+    return 0;
+}
+
+
+static int parse_args(int argc, char** argv)
+{
+    const char *short_opts = "hs:l:j:";
+    const struct option long_opts[] = {
+        { "help"               , no_argument       , NULL , 'h' },
+        { "socket"             , required_argument , NULL , 's' },
+        { "latency"            , required_argument , NULL , 'l' },
+        { "jitter"             , required_argument , NULL , 'j' },
+        { NULL , 0 , NULL , 0 }
+    };
+
+    int opt;
+    int opt_index;
+    int error = 0;
+
+    while (1) {
+        opt = getopt_long(argc, argv, short_opts, long_opts, &opt_index);
+
+        if (opt == -1) {
+            break;
+        }
+
+        switch (opt) {
+            case 'h':
+                conf.help = 1;
+                break;
+
+            case 's':
+                conf.socket = optarg;
+                break;
+
+            case 'l':
+                conf.latency = strtoul(optarg, NULL, 0);
+                break;
+
+            case 'j':
+                conf.jitter = strtoul(optarg, NULL, 0);
+                break;
+
+            default:
+                error = 1;
+                break;
+        }
+    }
+
+    while (optind < argc) {
+        error = 1;
+
+        printf("%s: invalid argument \'%s\'\n", argv[0], argv[optind]);
+        optind++;
+    }
+
+    return error;
+}
+
+static void print_usage(char* cmd)
+{
+    printf("Usage: %s [OPTION]...\n", cmd);
+    printf("\n");
+    printf("Options:\n");
+    printf("  -h, --help             Display this help and exit\n");
+    printf("  -s, --socket <path>    Listen on path [default: $XENSTORED_PATH or /var/run/xenstored/socket]\n");
+    printf("  -l, --latency <usec>   Delay every reply by usec\n");
+    printf("  -j, --jitter <usec>    Add up to usec of random delay to every reply\n");
+}
+
+
+int main(int argc, char** argv)
+{
+    int i;
+    int lfd;
+    int err;
+    struct timespec ts;
+    struct timespec* timeout;
+    uint64_t now;
+    uint64_t next;
+    struct sockaddr_un addr;
+
+    struct pollfd fds[MAX_CONNS + 1];
+    int idx[MAX_CONNS + 1];
+    nfds_t nfds;
+
+
+    /* Parse arguments */
+    conf.socket = getenv("XENSTORED_PATH");
+    if (conf.socket == NULL) {
+        conf.socket = "/var/run/xenstored/socket";
+    }
+
+    err = parse_args(argc, argv);
+    if (err || conf.help) {
+        print_usage(argv[0]);
+        return err ? 1 : 0;
+    }
+
+    if (strlen(conf.socket) >= sizeof(addr.sun_path)) {
+        printf("Socket path too long.\n");
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    root = node_new("", 0);
+    node_lookup(root, "/local/domain/0", 1, NULL);
+
+
+    /* setup socket */
+    lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (lfd < 0) {
+        perror("socket");
+        return 1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, conf.socket);
+    unlink(conf.socket);
+
+    if (bind(lfd, (struct sockaddr*) &addr, sizeof(addr)) < 0 || listen(lfd, 128) < 0) {
+        perror(conf.socket);
+        return 1;
+    }
+
+
+    /* main loop */
+    while (1) {
+        now = now_us();
+        next = 0;
+        nfds = 1;
+
+        fds[0].fd = lfd;
+        fds[0].events = POLLIN;
+
+        for (i = 0; i < MAX_CONNS; i++) {
+            if (conns[i] == NULL) {
+                continue;
+            }
+
+            if (conn_flush(conns[i], now)) {
+                conn_close(i);
+                continue;
+            }
+
+            if (conns[i]->replies && (next == 0 || conns[i]->replies->due < next)) {
+                next = conns[i]->replies->due;
+            }
+
+            fds[nfds].fd = conns[i]->fd;
+            fds[nfds].events = conns[i]->out_len ? POLLIN | POLLOUT : POLLIN;
+            idx[nfds] = i;
+            nfds++;
+        }
+
+        timeout = NULL;
+        if (next) {
+            next = next > now ? next - now : 0;
+            ts.tv_sec = next / 1000000;
+            ts.tv_nsec = (next % 1000000) * 1000;
+            timeout = &ts;
+        }
+
+        if (ppoll(fds, nfds, timeout, NULL) < 0) {
+            continue;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            conn_accept(lfd);
+        }
+
+        for (i = 1; i < nfds; i++) {
+            if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                if (conn_read(conns[idx[i]])) {
+                    conn_close(idx[i]);
+                }
+            }
+        }
+    }
+
+    return 0;
+}